@@ -0,0 +1,71 @@
+#include <assert.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Size of the blocks allocated for the arena. Allocations larger than this get a block of their own.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+#define _align8(n) (((n) + 7) & ~((u64)7))
+
+/**
+ * The blocks of an arena form a list from the most recently allocated block and backwards.
+ *
+ * [ previous (8 bytes) ][ capacity (8 bytes) ][ used (8 bytes) ][ data (capacity bytes) ]
+ */
+struct ArenaBlock {
+    ArenaBlock* previous;
+    u64 capacity;
+    u64 used;
+};
+
+void* arena_alloc(Arena* arena, u64 size)
+{
+    u64 aligned_size = _align8(size);
+    ArenaBlock* block = arena->current;
+    if (!block || (block->used + aligned_size) > block->capacity) {
+        u64 capacity = aligned_size > ARENA_BLOCK_SIZE ? aligned_size : ARENA_BLOCK_SIZE;
+        block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + capacity);
+        assert(block);
+        block->previous = arena->current;
+        block->capacity = capacity;
+        block->used = 0;
+        arena->current = block;
+    }
+
+    u8* result = ((u8*)(block + 1)) + block->used;
+    block->used += aligned_size;
+
+    // NOTE(christoffer) Zero the memory to match the calloc based ALLOC. Blocks are reused after
+    // arena_reset(), so the memory can't be assumed to be zero.
+    memset(result, 0, size);
+    return result;
+}
+
+ArenaMark
+arena_mark(Arena* arena)
+{
+    ArenaMark mark = {};
+    mark.block = arena->current;
+    mark.used = arena->current ? arena->current->used : 0;
+    return mark;
+}
+
+void arena_reset(Arena* arena, ArenaMark mark)
+{
+    while (arena->current != mark.block) {
+        // The mark must be from this arena, and no older than the last reset
+        assert(arena->current);
+        ArenaBlock* dead = arena->current;
+        arena->current = dead->previous;
+        free(dead);
+    }
+    if (arena->current) {
+        arena->current->used = mark.used;
+    }
+}
+
+void arena_release(Arena* arena)
+{
+    arena_reset(arena, ArenaMark {});
+}
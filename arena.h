@@ -0,0 +1,37 @@
+#pragma once
+
+#include "base.h"
+
+/**
+ * A bump allocator. Allocations are carved out of larger blocks, and are never freed one by one.
+ * Instead everything allocated from the arena is released at once using arena_release(), or
+ * everything allocated after a certain point using arena_mark() and arena_reset().
+ *
+ * A zero initialized Arena is an empty arena, ready to be used.
+ */
+
+struct ArenaBlock;
+
+struct Arena {
+    ArenaBlock* current = 0;
+};
+
+/** A position in an arena that it can be reset to. */
+struct ArenaMark {
+    ArenaBlock* block = 0;
+    u64 used = 0;
+};
+
+#define ARENA_ALLOC(arena, type, count) ((type*)arena_alloc(arena, sizeof(type) * (count)))
+
+/** Returns 'size' bytes of zeroed memory, aligned to 8 bytes. */
+void* arena_alloc(Arena* arena, u64 size);
+
+/** Returns the current position of the arena. */
+ArenaMark arena_mark(Arena* arena);
+
+/** Releases everything allocated from the arena since 'mark' was taken. */
+void arena_reset(Arena* arena, ArenaMark mark);
+
+/** Releases everything allocated from the arena, and leaves it empty. */
+void arena_release(Arena* arena);
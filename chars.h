@@ -0,0 +1,74 @@
+#pragma once
+
+#include "base.h"
+
+/**
+ * Character classes used by the config parser, the template tokenizer and the command line
+ * validation. A character can belong to several classes, so the classes are bit flags and a
+ * set of classes is tested with a single mask.
+ */
+enum CharClass : u8 {
+    CharClass_Alpha = 1 << 0,
+    CharClass_Digit = 1 << 1,
+    // The non-alphanumeric characters allowed in identifiers ('-' and '_')
+    CharClass_IdentifierPunct = 1 << 2,
+    // Whitespace within a line. Only plain spaces are treated as whitespace.
+    CharClass_Space = 1 << 3,
+
+    // Characters allowed in action and variable names
+    CharClass_Identifier = CharClass_Alpha | CharClass_Digit | CharClass_IdentifierPunct,
+};
+
+/**
+ * Table of the classes of every byte value, generated at compile time.
+ *
+ * NOTE(christoffer) Classifying through a table is a single load and mask, instead of the chain
+ * of range comparisons (and branches) that testing each class directly takes.
+ */
+struct CharClassTable {
+    u8 classes[256];
+
+    constexpr CharClassTable()
+        : classes()
+    {
+        for (u32 c = 0; c < 256; c++) {
+            u8 flags = 0;
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+                flags |= CharClass_Alpha;
+            }
+            if (c >= '0' && c <= '9') {
+                flags |= CharClass_Digit;
+            }
+            if (c == '-' || c == '_') {
+                flags |= CharClass_IdentifierPunct;
+            }
+            if (c == ' ') {
+                flags |= CharClass_Space;
+            }
+            classes[c] = flags;
+        }
+    }
+};
+
+static constexpr CharClassTable char_class_table = CharClassTable();
+
+/** Returns true if the character belongs to any of the classes in 'mask'. */
+inline bool
+char_is(char c, u32 mask)
+{
+    return char_class_table.classes[(u8)c] & mask;
+}
+
+/**
+ * Returns the offset of the first character at or after 'offset' (and before 'end') that doesn't
+ * belong to any of the classes in 'Mask', or 'end' if they all do.
+ */
+template <u32 Mask>
+inline u32
+scan_while(const char* chars, u32 offset, u32 end)
+{
+    while (offset < end && (char_class_table.classes[(u8)chars[offset]] & Mask)) {
+        offset++;
+    }
+    return offset;
+}
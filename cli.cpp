@@ -2,23 +2,17 @@
 #include <limits.h>
 #include <stdio.h>
 
+#include "chars.h"
 #include "cli.h"
 
-#define is_alpha(c) ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
-#define is_identchr(c) (is_alpha(c) || (c >= '0' && c <= '9') || c == '-' || c == '_')
-
-#define MAX_POS_ARGS 10
-
 static bool
 is_identifier(const char* val)
 {
-    u32 i = cstrlen(val);
-    while (i--) {
-        if ((i == 0 && !is_alpha(val[i])) || (i > 0 && !is_identchr(val[i]))) {
-            return false;
-        }
+    u32 len = cstrlen(val);
+    if (!len) {
+        return true;
     }
-    return true;
+    return char_is(val[0], CharClass_Alpha) && scan_while<CharClass_Identifier>(val, 1, len) == len;
 }
 
 ParseResult
@@ -32,7 +26,6 @@ parse_cli_args(CommandLineOptions* options, int num_args, char** args)
         return ParseResult_Ok;
     }
 
-    u8 num_pos_args = 0;
     int arg_index = 1; // Skip binary name
     char* current_arg = args[arg_index];
     while (arg_index < num_args) {
@@ -54,7 +47,7 @@ parse_cli_args(CommandLineOptions* options, int num_args, char** args)
                 }
 
                 if (char* resolved_path = realpath(current_arg, 0)) {
-                    options->config_files = string_list_add_front_dup(options->config_files, resolved_path);
+                    string_array_push(&options->arena, &options->config_files, resolved_path);
                     free(resolved_path);
                 } else {
                     fprintf(stdout, "Warning: could not read the config file '%s'. Ignoring.\n", current_arg);
@@ -84,13 +77,11 @@ parse_cli_args(CommandLineOptions* options, int num_args, char** args)
                 }
 
                 // Set or overwrite the template string
-                if (options->action_template) {
-                    options->action_template = string_copy(options->action_template, current_arg);
-                } else {
-                    options->action_template = string_new(current_arg);
-                }
+                options->action_template = string_new(&options->arena, current_arg);
             } else if (string_eq(current_arg, "--actions")) {
                 options->print_available_actions = true;
+            } else if (string_eq(current_arg, "--check")) {
+                options->check_configs = true;
             } else {
                 /*** Parse as named varible ***/
 
@@ -102,7 +93,7 @@ parse_cli_args(CommandLineOptions* options, int num_args, char** args)
 
                 // Advance one argument to get the value
                 if (++arg_index < num_args) {
-                    options->variables = template_set(options->variables, varname, args[arg_index]);
+                    template_set(&options->variables, varname, args[arg_index]);
                 } else {
                     fprintf(stdout, "Missing value for variable '%s'\n", varname);
                     return ParseResult_Invalid;
@@ -111,12 +102,11 @@ parse_cli_args(CommandLineOptions* options, int num_args, char** args)
         } else if (options->action_name) {
             // We've got an action name, and have already checked for any other known argument.
             // Treat this as a positional argument.
-            if (num_pos_args >= MAX_POS_ARGS) {
+            if (options->num_positional_args >= MAX_POS_ARGS) {
                 fprintf(stdout, "At most %d positional arguments can be given. Wrap arguments containing spaces in double quotes (\").\n", MAX_POS_ARGS);
                 return ParseResult_Invalid;
             }
-            char varname[2] = { (char)('0' + num_pos_args++), 0 };
-            options->variables = template_set(options->variables, varname, args[arg_index]);
+            options->positional_args[options->num_positional_args++] = args[arg_index];
         } else {
             //
             // If it's not a valid identifier, treat it as an error.
@@ -124,20 +114,20 @@ parse_cli_args(CommandLineOptions* options, int num_args, char** args)
                 fprintf(stdout, "'%s' is not a valid action name. Action names must start with a letter, followed by letters, numbers, a a dash (-) or an underscore (_)\n", current_arg);
                 return ParseResult_Invalid;
             }
-            options->action_name = string_new(current_arg);
+            options->action_name = string_new(&options->arena, current_arg);
         }
         current_arg = args[++arg_index];
     }
 
+    // The config files were added in the order they were given, but the last one given has the
+    // highest priority
+    string_array_reverse(&options->config_files);
+
     return ParseResult_Ok;
 }
 
 void free_cli_options_resources(CommandLineOptions options)
 {
-    if (options.action_name)
-        string_free(options.action_name);
-    if (options.action_template)
-        string_free(options.action_template);
-    string_list_free(options.config_files);
-    template_free(options.variables);
+    template_free(&options.variables);
+    arena_release(&options.arena);
 }
@@ -1,9 +1,13 @@
 #pragma once
 
+#include "arena.h"
 #include "base.h"
 #include "string.h"
 #include "templates.h"
 
+// Positional arguments map straight to the positional template slots ${0} to ${9}
+#define MAX_POS_ARGS TEMPLATE_POSITIONAL_SLOTS
+
 enum ParseResult {
     // Parsed OK, proceed with execution
     ParseResult_Ok,
@@ -15,6 +19,10 @@ enum ParseResult {
 
 /** The resulting configuration flags from parsing the CLI arguments given by the user. */
 struct CommandLineOptions {
+    // Per-invocation arena. The strings and lists below are allocated from it, and released
+    // all at once together with the options.
+    Arena arena = {};
+
     // The action name
     String action_name = 0;
 
@@ -24,7 +32,7 @@ struct CommandLineOptions {
     // List of configuration files given as arguments to the program.
     // Multiple ones can be given. The list is ordered by configuration priority
     // preference (most preferred is first in the list, least preferred is last).
-    StringList* config_files = 0;
+    StringArray config_files = {};
 
     // Flags
 
@@ -46,13 +54,18 @@ struct CommandLineOptions {
     // List all available actions
     bool print_available_actions = false;
 
+    // Parse and validate all config files
+    bool check_configs = false;
+
     // No arguments passed
     bool no_arguments_given = false;
 
-    // List of variables passed on the command line.
-    // Positional arguments will be named "0", "1", etc. Named arguments will
-    // have the given name (minus the leading --).
-    VarList* variables;
+    // Named variables passed on the command line (with the name minus the leading --).
+    VarMap variables = {};
+
+    // Positional arguments, in the order they were given. These point into the program arguments.
+    u8 num_positional_args = 0;
+    char* positional_args[MAX_POS_ARGS] = {};
 };
 
 ParseResult parse_cli_args(CommandLineOptions* options, int num_args, char** args);
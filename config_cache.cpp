@@ -0,0 +1,670 @@
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_cache.h"
+
+/**
+ * Layout of the compiled config data (both in memory and on disk):
+ *
+ * [ header ][ action entries ][ variable entries ][ variable table ][ includes ][ strings ]
+ *
+ * The variable table is an open addressing hash table of variable positions (plus one, 0 marks
+ * an empty slot), keyed by string_hash() of the names. It's built when the config is compiled,
+ * so looking up a default variable doesn't have to build anything at load time.
+ *
+ * The includes are the offsets of the paths of the included config files, as written in the
+ * config file. They're resolved when the config is loaded, so the cache doesn't depend on them.
+ *
+ * Every string is stored in the String layout (buffer size, length, content and a %nul), padded
+ * to 4 bytes so that the length of the following string stays aligned. The entries store the
+ * offset to the content of the strings, which means that they can be handed out as Strings
+ * directly from the mapped cache file.
+ */
+
+// "QSCC" (qs compiled config)
+#define CACHE_MAGIC 0x43435351
+// Bump whenever the layout changes to invalidate existing cache files
+#define CACHE_VERSION 3
+
+// Cache files that haven't been written for this long are removed (see prune_cache_dir())
+#define CACHE_MAX_AGE_SECONDS (30 * 24 * 60 * 60)
+// The cache directory is pruned at most this often, the time of the last pruning is the
+// modification time of the stamp file
+#define CACHE_PRUNE_INTERVAL_SECONDS (24 * 60 * 60)
+#define CACHE_PRUNE_STAMP_NAME "pruned.stamp"
+
+#define STRING_HEADER_SIZE 8
+#define NUL_SIZE 1
+
+#define _align4(n) (((n) + 3) & ~((u64)3))
+
+#ifdef __APPLE__
+#define _mtime_sec(st) ((st)->st_mtimespec.tv_sec)
+#define _mtime_nsec(st) ((st)->st_mtimespec.tv_nsec)
+#else
+#define _mtime_sec(st) ((st)->st_mtim.tv_sec)
+#define _mtime_nsec(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+struct CompiledConfigHeader {
+    u32 magic;
+    u32 version;
+
+    // Identity of the config file that the data was compiled from. A cache file is only valid
+    // as long as all of these match the current state of the config file.
+    u64 source_dev;
+    u64 source_ino;
+    u64 source_size;
+    s64 source_mtime_sec;
+    s64 source_mtime_nsec;
+
+    // Total size of the compiled data, including this header
+    u64 size;
+
+    u32 num_actions;
+    u32 num_vars;
+    u32 var_table_capacity;
+    u32 num_includes;
+};
+
+static bool
+header_matches_source(const CompiledConfigHeader* header, const struct stat* source_stat)
+{
+    return header->source_dev == (u64)source_stat->st_dev
+        && header->source_ino == (u64)source_stat->st_ino
+        && header->source_size == (u64)source_stat->st_size
+        && header->source_mtime_sec == (s64)_mtime_sec(source_stat)
+        && header->source_mtime_nsec == (s64)_mtime_nsec(source_stat);
+}
+
+static void
+set_entry_views(CompiledConfig* config)
+{
+    const CompiledConfigHeader* header = (const CompiledConfigHeader*)(void*)config->data;
+    config->num_actions = header->num_actions;
+    config->num_vars = header->num_vars;
+    config->actions = (const CompiledConfigEntry*)(void*)(config->data + sizeof(CompiledConfigHeader));
+    config->vars = config->actions + config->num_actions;
+    config->var_table_capacity = header->var_table_capacity;
+    config->var_table = (const u32*)(const void*)(config->vars + config->num_vars);
+    config->num_includes = header->num_includes;
+    config->includes = config->var_table + config->var_table_capacity;
+}
+
+/**
+ * Returns true if 'offset' is the content offset of a complete string record in the strings
+ * section (which starts at 'strings_offset') of the compiled config data.
+ */
+static bool
+is_valid_string_offset(const CompiledConfig* config, u64 strings_offset, u32 offset)
+{
+    if (offset < strings_offset + STRING_HEADER_SIZE || offset % 4 || offset >= config->size) {
+        return false;
+    }
+    const u8* record = config->data + offset - STRING_HEADER_SIZE;
+    u32 capacity = *((const u32*)(const void*)record);
+    u32 len = *((const u32*)(const void*)(record + 4));
+    return (u64)offset + len + NUL_SIZE <= config->size
+        && (u64)capacity == (u64)STRING_HEADER_SIZE + len + NUL_SIZE
+        && config->data[(u64)offset + len] == '\0';
+}
+
+/**
+ * Returns true if every string offset and variable table slot in the compiled config data points
+ * inside of it. A cache file can have been truncated or corrupted after it was written, and the
+ * offsets are used as is once it's loaded.
+ */
+static bool
+compiled_config_is_valid(const CompiledConfig* config)
+{
+    u64 strings_offset = (u64)((const u8*)(const void*)(config->includes + config->num_includes) - config->data);
+    for (u32 i = 0; i < config->num_actions; i++) {
+        const CompiledConfigEntry* action = config->actions + i;
+        if (!is_valid_string_offset(config, strings_offset, action->name_offset) || !is_valid_string_offset(config, strings_offset, action->value_offset)) {
+            return false;
+        }
+    }
+    for (u32 i = 0; i < config->num_vars; i++) {
+        const CompiledConfigEntry* var = config->vars + i;
+        if (!is_valid_string_offset(config, strings_offset, var->name_offset) || !is_valid_string_offset(config, strings_offset, var->value_offset)) {
+            return false;
+        }
+    }
+    for (u32 i = 0; i < config->num_includes; i++) {
+        if (!is_valid_string_offset(config, strings_offset, config->includes[i])) {
+            return false;
+        }
+    }
+
+    // A table without empty slots would make lookups of undeclared variables loop forever
+    u32 num_used_slots = 0;
+    for (u32 slot = 0; slot < config->var_table_capacity; slot++) {
+        if (config->var_table[slot] > config->num_vars) {
+            return false;
+        }
+        num_used_slots += config->var_table[slot] != 0;
+    }
+    return num_used_slots <= config->num_vars;
+}
+
+/** Returns the size of the variable table for 'num_vars' variables (a power of two, at most half full). */
+static u32
+var_table_capacity_for(u32 num_vars)
+{
+    if (!num_vars) {
+        return 0;
+    }
+    u32 capacity = 8;
+    while (capacity < num_vars * 2) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+/**
+ * Returns the directory where compiled configs are cached. This is $XDG_CACHE_HOME/qs, or
+ * $HOME/.cache/qs if XDG_CACHE_HOME isn't set. Returns 0 if neither variable is set.
+ */
+static String
+get_cache_dir(SmallString* storage)
+{
+    String cache_dir = 0;
+    char* xdg_cache_home_env = getenv("XDG_CACHE_HOME");
+    if (xdg_cache_home_env && *xdg_cache_home_env) {
+        cache_dir = string_new(storage, xdg_cache_home_env);
+    } else {
+        char* home = getenv("HOME");
+        if (home && *home) {
+            cache_dir = string_new(storage, home);
+            cache_dir = string_append(cache_dir, "/.cache");
+        }
+    }
+    return cache_dir;
+}
+
+/** Returns the path of the file with 'filename' in the qs cache directory, or 0 if there isn't one. */
+static String
+get_cache_file_path(SmallString* storage, const char* filename)
+{
+    String path = get_cache_dir(storage);
+    if (path) {
+        path = string_append(path, "/qs/");
+        path = string_append(path, filename);
+    }
+    return path;
+}
+
+static void
+get_compiled_config_filename(char* filename, u32 size, u64 source_dev, u64 source_ino)
+{
+    snprintf(filename, size, "%llx-%llx.cfgc", (unsigned long long)source_dev, (unsigned long long)source_ino);
+}
+
+/**
+ * Removes the files in the cache directory that haven't been written for CACHE_MAX_AGE_SECONDS,
+ * unless that was done less than CACHE_PRUNE_INTERVAL_SECONDS ago.
+ *
+ * NOTE(christoffer) The cache files are named after the inode of the config file or a hash of
+ * the directory path, so the files of deleted or moved configs and directories are never
+ * overwritten. A file that's still in use is just written again the next time it's needed.
+ */
+static void
+prune_cache_dir(const char* qs_cache_dir)
+{
+    SmallString stamp_path_storage;
+    String stamp_path = string_new(&stamp_path_storage, qs_cache_dir);
+    stamp_path = string_append(stamp_path, "/" CACHE_PRUNE_STAMP_NAME);
+    struct stat stamp_stat;
+    time_t now = time(0);
+    bool is_due = stat(stamp_path, &stamp_stat) != 0 || _mtime_sec(&stamp_stat) < now - CACHE_PRUNE_INTERVAL_SECONDS;
+    if (is_due) {
+        // Writing the stamp first keeps concurrent runs from pruning at the same time
+        int stamp_fd = open(stamp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (stamp_fd >= 0) {
+            close(stamp_fd);
+        }
+    }
+    string_free(stamp_path);
+    DIR* dir = is_due ? opendir(qs_cache_dir) : 0;
+    if (!dir) {
+        return;
+    }
+
+    time_t oldest = now - CACHE_MAX_AGE_SECONDS;
+    int dir_fd = dirfd(dir);
+    while (struct dirent* entry = readdir(dir)) {
+        const char* suffix = strrchr(entry->d_name, '.');
+        bool is_cache_file = suffix && (string_eq(suffix, ".cfgc") || string_eq(suffix, ".qsd") || string_eq(suffix, ".tmp"));
+        struct stat entry_stat;
+        if (is_cache_file && fstatat(dir_fd, entry->d_name, &entry_stat, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(entry_stat.st_mode) && _mtime_sec(&entry_stat) < oldest) {
+            unlinkat(dir_fd, entry->d_name, 0);
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * Writes the data to the file with 'filename' in the cache directory (creating the directory if
+ * needed). The write is atomic. Failing to write the file is not an error.
+ */
+static void
+write_cache_file(const char* filename, const u8* data, u64 size)
+{
+    SmallString cache_dir_storage, qs_cache_dir_storage, cache_path_storage, tmp_path_storage;
+    String cache_dir = get_cache_dir(&cache_dir_storage);
+    if (!cache_dir) {
+        return;
+    }
+
+    // Make sure that the cache directory exists. Failing here will also fail opening the
+    // temporary file below, so there's no need to check the results.
+    mkdir(cache_dir, 0700);
+    String qs_cache_dir = string_new(&qs_cache_dir_storage, cache_dir);
+    qs_cache_dir = string_append(qs_cache_dir, "/qs");
+    mkdir(qs_cache_dir, 0700);
+
+    // Checking once per run is enough, even if several cache files are written
+    static bool pruned = false;
+    if (!__atomic_exchange_n(&pruned, true, __ATOMIC_RELAXED)) {
+        prune_cache_dir(qs_cache_dir);
+    }
+    string_free(qs_cache_dir);
+    string_free(cache_dir);
+
+    String cache_path = get_cache_file_path(&cache_path_storage, filename);
+
+    // NOTE(christoffer) Write the data to a file that is private to this write and then rename it
+    // over the cache file. Renames are atomic, so any concurrently running qs will either read the
+    // old file or the new one, but never a partially written file. The counter keeps the temporary
+    // files apart when several threads of this process write the same cache file.
+    static u32 num_tmp_files = 0;
+    u32 tmp_file_id = __atomic_fetch_add(&num_tmp_files, 1, __ATOMIC_RELAXED);
+    char tmp_suffix[32] = { 0 };
+    snprintf(tmp_suffix, sizeof(tmp_suffix), ".%d.%u.tmp", (int)getpid(), tmp_file_id);
+    String tmp_path = string_new(&tmp_path_storage, cache_path);
+    tmp_path = string_append(tmp_path, tmp_suffix);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        bool ok = true;
+        u64 written = 0;
+        while (ok && written < size) {
+            ssize_t n = write(fd, data + written, size - written);
+            if (n > 0) {
+                written += (u64)n;
+            } else {
+                ok = false;
+            }
+        }
+        ok = (close(fd) == 0) && ok;
+
+        if (!ok || rename(tmp_path, cache_path) != 0) {
+            unlink(tmp_path);
+        }
+    }
+
+    string_free(tmp_path);
+    string_free(cache_path);
+}
+
+static u64
+string_record_size(u32 len)
+{
+    return _align4(STRING_HEADER_SIZE + len + NUL_SIZE);
+}
+
+/**
+ * Writes the content as a String record at 'offset' into 'data', and advances offset past the
+ * record. Returns the offset of the string content.
+ */
+static u32
+put_string(u8* data, u64* offset, const char* content, u32 len)
+{
+    u8* record = data + *offset;
+    *((u32*)(void*)record) = STRING_HEADER_SIZE + len + NUL_SIZE;
+    *((u32*)(void*)(record + 4)) = len;
+    memcpy(record + STRING_HEADER_SIZE, content, len);
+    record[STRING_HEADER_SIZE + len] = '\0';
+
+    u32 content_offset = (u32)(*offset + STRING_HEADER_SIZE);
+    *offset += string_record_size(len);
+    return content_offset;
+}
+
+bool compile_config(const struct stat* source_stat, ActionTemplatePair* pairs, VarMap* vars, StringArray* includes, CompiledConfig* config)
+{
+    u32 num_actions = 0;
+    u32 num_vars = 0;
+    u64 strings_size = 0;
+    for (ActionTemplatePair* pair = pairs; pair; pair = pair->next) {
+        strings_size += string_record_size(string_len(pair->action_name)) + string_record_size(string_len(pair->action_template));
+        num_actions++;
+    }
+    for (u32 i = 0; i < vars->count; i++) {
+        strings_size += string_record_size(intern_view(vars->entries[i].name).length) + string_record_size(vars->entries[i].value.length);
+        num_vars++;
+    }
+    for (u32 i = 0; i < includes->count; i++) {
+        strings_size += string_record_size(string_len(includes->items[i]));
+    }
+
+    u32 var_table_capacity = var_table_capacity_for(num_vars);
+    u64 entries_offset = sizeof(CompiledConfigHeader);
+    u64 var_table_offset = entries_offset + (num_actions + num_vars) * sizeof(CompiledConfigEntry);
+    u64 includes_offset = var_table_offset + var_table_capacity * sizeof(u32);
+    u64 strings_offset = includes_offset + includes->count * sizeof(u32);
+    u64 size = strings_offset + strings_size;
+    if (size > UINT32_MAX) {
+        // Offsets are stored as 32 bit values
+        return false;
+    }
+
+    u8* data = ALLOC(u8, size);
+    assert(data);
+
+    CompiledConfigHeader* header = (CompiledConfigHeader*)(void*)data;
+    header->magic = CACHE_MAGIC;
+    header->version = CACHE_VERSION;
+    header->source_dev = (u64)source_stat->st_dev;
+    header->source_ino = (u64)source_stat->st_ino;
+    header->source_size = (u64)source_stat->st_size;
+    header->source_mtime_sec = (s64)_mtime_sec(source_stat);
+    header->source_mtime_nsec = (s64)_mtime_nsec(source_stat);
+    header->size = size;
+    header->num_actions = num_actions;
+    header->num_vars = num_vars;
+    header->var_table_capacity = var_table_capacity;
+    header->num_includes = includes->count;
+
+    CompiledConfigEntry* entry = (CompiledConfigEntry*)(void*)(data + entries_offset);
+    u64 offset = strings_offset;
+    for (ActionTemplatePair* pair = pairs; pair; pair = pair->next, entry++) {
+        entry->name_offset = put_string(data, &offset, pair->action_name, string_len(pair->action_name));
+        entry->value_offset = put_string(data, &offset, pair->action_template, string_len(pair->action_template));
+    }
+    for (u32 i = 0; i < vars->count; i++, entry++) {
+        VarEntry* var = vars->entries + i;
+        StringView name = intern_view(var->name);
+        entry->name_offset = put_string(data, &offset, name.chars, name.length);
+        entry->value_offset = put_string(data, &offset, inline_string_chars(&var->value), var->value.length);
+    }
+    u32* include_offsets = (u32*)(void*)(data + includes_offset);
+    for (u32 i = 0; i < includes->count; i++) {
+        include_offsets[i] = put_string(data, &offset, includes->items[i], string_len(includes->items[i]));
+    }
+    assert(offset == size);
+
+    // The names are unique within the config, so every variable gets an empty slot of its own
+    u32* var_table = (u32*)(void*)(data + var_table_offset);
+    for (u32 i = 0; i < num_vars; i++) {
+        u32 slot = intern_hash(vars->entries[i].name) & (var_table_capacity - 1);
+        while (var_table[slot]) {
+            slot = (slot + 1) & (var_table_capacity - 1);
+        }
+        var_table[slot] = i + 1;
+    }
+
+    config->data = data;
+    config->size = size;
+    config->is_mapped = false;
+    set_entry_views(config);
+    return true;
+}
+
+bool config_cache_load(const struct stat* source_stat, CompiledConfig* config)
+{
+    SmallString cache_path_storage;
+    char filename[64] = { 0 };
+    get_compiled_config_filename(filename, sizeof(filename), (u64)source_stat->st_dev, (u64)source_stat->st_ino);
+    String cache_path = get_cache_file_path(&cache_path_storage, filename);
+    if (!cache_path) {
+        return false;
+    }
+
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        string_free(cache_path);
+        return false;
+    }
+
+    bool hit = false;
+    bool corrupted = false;
+    struct stat cache_stat;
+    if (fstat(fd, &cache_stat) == 0) {
+        u64 size = (u64)cache_stat.st_size;
+        void* mapping = size >= sizeof(CompiledConfigHeader) ? mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (mapping != MAP_FAILED) {
+            const CompiledConfigHeader* header = (const CompiledConfigHeader*)mapping;
+            u64 entries_size = ((u64)header->num_actions + header->num_vars) * sizeof(CompiledConfigEntry);
+            u64 tables_size = ((u64)header->var_table_capacity + header->num_includes) * sizeof(u32);
+            corrupted = header->magic != CACHE_MAGIC
+                || header->version != CACHE_VERSION
+                || header->size != size
+                || header->var_table_capacity != var_table_capacity_for(header->num_vars)
+                || sizeof(CompiledConfigHeader) + entries_size + tables_size > size;
+            if (!corrupted && header_matches_source(header, source_stat)) {
+                CompiledConfig mapped = {};
+                mapped.data = (u8*)mapping;
+                mapped.size = size;
+                mapped.is_mapped = true;
+                set_entry_views(&mapped);
+                corrupted = !compiled_config_is_valid(&mapped);
+                if (!corrupted) {
+                    *config = mapped;
+                    hit = true;
+                }
+            }
+            if (!hit) {
+                munmap(mapping, size);
+            }
+        } else {
+            corrupted = size < sizeof(CompiledConfigHeader);
+        }
+    }
+    close(fd);
+
+    // The config is parsed again, and written to the cache if it can be
+    if (corrupted) {
+        unlink(cache_path);
+    }
+    string_free(cache_path);
+    return hit;
+}
+
+void config_cache_store(const CompiledConfig* config)
+{
+    const CompiledConfigHeader* header = (const CompiledConfigHeader*)(void*)config->data;
+    char filename[64] = { 0 };
+    get_compiled_config_filename(filename, sizeof(filename), header->source_dev, header->source_ino);
+    write_cache_file(filename, config->data, config->size);
+}
+
+void dir_stamp_set(DirStamp* stamp, const struct stat* dir_stat)
+{
+    stamp->ino = (u64)dir_stat->st_ino;
+    stamp->mtime_sec = (s64)_mtime_sec(dir_stat);
+    stamp->mtime_nsec = (s64)_mtime_nsec(dir_stat);
+}
+
+bool dir_stamp_matches(const DirStamp* stamp, const struct stat* dir_stat)
+{
+    return stamp->ino == (u64)dir_stat->st_ino
+        && stamp->mtime_sec == (s64)_mtime_sec(dir_stat)
+        && stamp->mtime_nsec == (s64)_mtime_nsec(dir_stat);
+}
+
+/**
+ * Layout of a discovery cache file:
+ *
+ * [ header ][ directory stamps ][ directory path ][ cwd config path ][ source root config path ]
+ *
+ * The paths are %nul terminated, and the missing config paths are empty. The directory path is
+ * stored to tell apart directories whose paths hash to the same file name.
+ */
+
+// "QSDC" (qs discovery cache)
+#define DISCOVERY_CACHE_MAGIC 0x43445351
+#define DISCOVERY_CACHE_VERSION 2
+
+// The stamps and three paths always fit in this size
+#define DISCOVERY_CACHE_MAX_SIZE (sizeof(DiscoveryCacheHeader) + (PATH_MAX / 2 + 1) * sizeof(DirStamp) + 3 * PATH_MAX)
+
+struct DiscoveryCacheHeader {
+    u32 magic;
+    u32 version;
+    u32 num_stamps;
+    s32 source_root_level;
+    u32 dir_path_size;
+    u32 cwd_config_size;
+    u32 source_root_config_size;
+    // Keeps the stamps that follow the header aligned
+    u32 padding;
+};
+
+static void
+get_discovery_filename(char* filename, u32 size, const char* dir_path)
+{
+    snprintf(filename, size, "dir-%08x.qsd", string_hash(dir_path));
+}
+
+bool discovery_cache_load(Arena* arena, const char* dir_path, DiscoveredConfigs* discovered)
+{
+    SmallString cache_path_storage;
+    char filename[64] = { 0 };
+    get_discovery_filename(filename, sizeof(filename), dir_path);
+    String cache_path = get_cache_file_path(&cache_path_storage, filename);
+    if (!cache_path) {
+        return false;
+    }
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    string_free(cache_path);
+    if (fd < 0) {
+        return false;
+    }
+
+    // The cache files are small regular files, so a single read gets all of it (a short read means
+    // that the end of the file was reached)
+    u8* data = ARENA_ALLOC(arena, u8, DISCOVERY_CACHE_MAX_SIZE);
+    ssize_t size = read(fd, data, DISCOVERY_CACHE_MAX_SIZE);
+    close(fd);
+    if (size < (ssize_t)sizeof(DiscoveryCacheHeader)) {
+        return false;
+    }
+
+    const DiscoveryCacheHeader* header = (const DiscoveryCacheHeader*)(void*)data;
+    u64 stamps_size = (u64)header->num_stamps * sizeof(DirStamp);
+    u64 expected_size = sizeof(DiscoveryCacheHeader) + stamps_size + header->dir_path_size + header->cwd_config_size + header->source_root_config_size;
+    if (
+        header->magic != DISCOVERY_CACHE_MAGIC
+        || header->version != DISCOVERY_CACHE_VERSION
+        || expected_size != (u64)size
+        || !header->dir_path_size || !header->cwd_config_size || !header->source_root_config_size) {
+        return false;
+    }
+
+    const char* paths = (const char*)(data + sizeof(DiscoveryCacheHeader) + stamps_size);
+    const char* cwd_config = paths + header->dir_path_size;
+    const char* source_root_config = cwd_config + header->cwd_config_size;
+    if (
+        paths[header->dir_path_size - 1] || cwd_config[header->cwd_config_size - 1] || source_root_config[header->source_root_config_size - 1]
+        || !string_eq(paths, dir_path)) {
+        return false;
+    }
+
+    discovered->num_stamps = header->num_stamps;
+    discovered->source_root_level = header->source_root_level;
+    discovered->stamps = (const DirStamp*)(const void*)(data + sizeof(DiscoveryCacheHeader));
+    discovered->cwd_config = *cwd_config ? cwd_config : 0;
+    discovered->source_root_config = *source_root_config ? source_root_config : 0;
+    return true;
+}
+
+void discovery_cache_store(const char* dir_path, const DiscoveredConfigs* discovered)
+{
+    const char* cwd_config = discovered->cwd_config ? discovered->cwd_config : "";
+    const char* source_root_config = discovered->source_root_config ? discovered->source_root_config : "";
+
+    DiscoveryCacheHeader header = {};
+    header.magic = DISCOVERY_CACHE_MAGIC;
+    header.version = DISCOVERY_CACHE_VERSION;
+    header.num_stamps = discovered->num_stamps;
+    header.source_root_level = discovered->source_root_level;
+    header.dir_path_size = cstrlen(dir_path) + NUL_SIZE;
+    header.cwd_config_size = cstrlen(cwd_config) + NUL_SIZE;
+    header.source_root_config_size = cstrlen(source_root_config) + NUL_SIZE;
+
+    u64 stamps_size = (u64)header.num_stamps * sizeof(DirStamp);
+    u64 size = sizeof(DiscoveryCacheHeader) + stamps_size + header.dir_path_size + header.cwd_config_size + header.source_root_config_size;
+    if (size > DISCOVERY_CACHE_MAX_SIZE) {
+        return;
+    }
+
+    u8* data = ALLOC(u8, size);
+    assert(data);
+    u8* cursor = data;
+    memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    memcpy(cursor, discovered->stamps, stamps_size);
+    cursor += stamps_size;
+    memcpy(cursor, dir_path, header.dir_path_size);
+    cursor += header.dir_path_size;
+    memcpy(cursor, cwd_config, header.cwd_config_size);
+    cursor += header.cwd_config_size;
+    memcpy(cursor, source_root_config, header.source_root_config_size);
+
+    char filename[64] = { 0 };
+    get_discovery_filename(filename, sizeof(filename), dir_path);
+    write_cache_file(filename, data, size);
+    free(data);
+}
+
+void compiled_config_source(const CompiledConfig* config, u64* dev, u64* ino)
+{
+    const CompiledConfigHeader* header = (const CompiledConfigHeader*)(void*)config->data;
+    *dev = header->source_dev;
+    *ino = header->source_ino;
+}
+
+String
+compiled_config_string(const CompiledConfig* config, u32 offset)
+{
+    assert(offset < config->size);
+    return (String)(config->data + offset);
+}
+
+String
+compiled_config_get_var(const CompiledConfig* config, NameId name)
+{
+    if (!config->var_table_capacity) {
+        return 0;
+    }
+    StringView view = intern_view(name);
+    u32 mask = config->var_table_capacity - 1;
+    for (u32 slot = intern_hash(name) & mask; config->var_table[slot]; slot = (slot + 1) & mask) {
+        const CompiledConfigEntry* var = config->vars + config->var_table[slot] - 1;
+        String var_name = compiled_config_string(config, var->name_offset);
+        if (string_view_eq(string_view(var_name, string_len(var_name)), view)) {
+            return compiled_config_string(config, var->value_offset);
+        }
+    }
+    return 0;
+}
+
+void compiled_config_free(CompiledConfig* config)
+{
+    if (config->data) {
+        if (config->is_mapped) {
+            munmap(config->data, config->size);
+        } else {
+            free(config->data);
+        }
+    }
+    *config = {};
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include "base.h"
+#include "configs.h"
+#include "string.h"
+#include "templates.h"
+
+/** A name and value pair in a compiled config. Both are offsets to strings in the config data. */
+struct CompiledConfigEntry {
+    u32 name_offset;
+    u32 value_offset;
+};
+
+/**
+ * The compiled form of a parsed config file: all actions (in declaration order, without
+ * duplicates) and all default variables, laid out in a single contiguous block of memory.
+ *
+ * The block is either memory mapped from the on-disk cache, or allocated on the heap when
+ * compiling a freshly parsed config. In both cases the strings are stored in the String layout,
+ * so a pointer into the block can be used as a (read-only) String without copying it.
+ */
+struct CompiledConfig {
+    u8* data = 0;
+    u64 size = 0;
+    bool is_mapped = false;
+
+    u32 num_actions = 0;
+    const CompiledConfigEntry* actions = 0;
+
+    u32 num_vars = 0;
+    const CompiledConfigEntry* vars = 0;
+
+    // Hash table of the variables (see compiled_config_get_var())
+    u32 var_table_capacity = 0;
+    const u32* var_table = 0;
+
+    // String offsets of the paths of the included config files, in declaration order
+    u32 num_includes = 0;
+    const u32* includes = 0;
+};
+
+/**
+ * Compiles the parsed actions, variables and include paths of the config file described by
+ * 'source_stat'. Returns true if successful, false if the config is too large to be compiled.
+ */
+bool compile_config(const struct stat* source_stat, ActionTemplatePair* pairs, VarMap* vars, StringArray* includes, CompiledConfig* config);
+
+/**
+ * Looks for a compiled config in the cache ($XDG_CACHE_HOME/qs) that matches the inode, size and
+ * modification time in 'source_stat', and maps it into memory.
+ * Returns true on a cache hit, false otherwise (nothing is written to 'config' in this case).
+ */
+bool config_cache_load(const struct stat* source_stat, CompiledConfig* config);
+
+/**
+ * Writes the compiled config to the cache. The write is atomic; concurrent readers either see
+ * the previous cache file or the complete new one. Failing to write the cache is not an error.
+ */
+void config_cache_store(const CompiledConfig* config);
+
+/** The identity and modification time of a directory, used to detect changes to it. */
+struct DirStamp {
+    u64 ino;
+    s64 mtime_sec;
+    s64 mtime_nsec;
+};
+
+/** Fills in the stamp of the directory described by 'dir_stat'. */
+void dir_stamp_set(DirStamp* stamp, const struct stat* dir_stat);
+
+/** Returns true if the stamp matches the directory described by 'dir_stat'. */
+bool dir_stamp_matches(const DirStamp* stamp, const struct stat* dir_stat);
+
+/**
+ * The config files discovered in the source tree of a directory: the config in the directory
+ * itself and the one in its source root (either can be 0), and where the source root is.
+ *
+ * The stamps are of the directories that were searched, starting at the directory itself and
+ * walking up to the source root (or the file system root if there wasn't a source root). The
+ * result stays valid as long as none of them changes, since adding or removing a config file
+ * or a source root marker modifies the directory that contains it.
+ */
+struct DiscoveredConfigs {
+    u32 num_stamps = 0;
+    const DirStamp* stamps = 0;
+    // The number of levels up from the directory to its source root, or -1 if there isn't one
+    s32 source_root_level = -1;
+    const char* cwd_config = 0;
+    const char* source_root_config = 0;
+};
+
+/**
+ * Looks up the configs discovered for the directory at 'dir_path' in the cache. The entry is
+ * allocated from the arena. Returns true on a cache hit. The stamps must be validated by the caller.
+ */
+bool discovery_cache_load(Arena* arena, const char* dir_path, DiscoveredConfigs* discovered);
+
+/** Writes the configs discovered for the directory at 'dir_path' to the cache. */
+void discovery_cache_store(const char* dir_path, const DiscoveredConfigs* discovered);
+
+/** Returns the device and inode of the config file that the config was compiled from. */
+void compiled_config_source(const CompiledConfig* config, u64* dev, u64* ino);
+
+/** Returns the string stored at 'offset' in the compiled config data. */
+String compiled_config_string(const CompiledConfig* config, u32 offset);
+
+/**
+ * Returns the value of the default variable with 'name' in the compiled config, or 0 if the
+ * config doesn't declare it. The lookup uses the hash table stored in the config data.
+ */
+String compiled_config_get_var(const CompiledConfig* config, NameId name);
+
+/** Unmaps or frees the compiled config data. Any strings returned for it are invalid after this call. */
+void compiled_config_free(CompiledConfig* config);
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "base.h"
+#include "chars.h"
+#include "string.h"
+
+/**
+ * Classification of config lines, 16 characters at a time.
+ *
+ * Every line of a config file is one of a few kinds, and for the common kinds (actions and
+ * variables) all the parser needs is the columns where the name and the value start and end. The
+ * columns are found by computing masks of the spaces and the identifier characters of whole
+ * blocks of the line at once (using SSE2 where available), and then finding the first character
+ * that doesn't match in the masks with bit operations.
+ *
+ * The masks of the first CONFIG_LINE_WINDOW_SIZE columns are computed up front, and for most
+ * lines all the columns are in that window. Columns past it are found a block at a time.
+ *
+ * Lines that aren't well-formed actions or variables are classified as 'other', and are left to
+ * the character by character parsing, which reports the errors.
+ */
+
+enum ConfigLineKind : u8 {
+    // Empty, or whitespace only
+    ConfigLineKind_Blank = 0,
+    // Starts with a '#' (after any whitespace)
+    ConfigLineKind_Comment,
+    // <name> = <value>
+    ConfigLineKind_Action,
+    // <name> := <value>
+    ConfigLineKind_Variable,
+    // Anything else (directives and invalid lines)
+    ConfigLineKind_Other,
+};
+
+/** The columns of the name and the value of an action or variable line. */
+struct ConfigLineColumns {
+    u32 name_start = 0;
+    u32 name_end = 0;
+    // The first non-whitespace column after the '=' or ':=', or the length of the line
+    u32 value_start = 0;
+};
+
+#define CONFIG_LINE_BLOCK_SIZE 16
+
+/**
+ * A block of the characters of a line, starting at a column. Blocks that extend past the end of
+ * the line are padded with newlines, which no mask matches (lines never contain newlines), so the
+ * scans always stop at the end of the line.
+ */
+struct ConfigLineBlock {
+#if defined(__SSE2__)
+    __m128i chars;
+#else
+    char chars[CONFIG_LINE_BLOCK_SIZE];
+#endif
+};
+
+// The smallest page size of the supported platforms (see string.cpp)
+#define CONFIG_LINE_MIN_PAGE_SIZE 4096
+
+/**
+ * Loads the block of the line that starts at 'offset' (which can be past the end of the line).
+ *
+ * NOTE(christoffer) A block at the end of the line is read in full as long as the read doesn't
+ * cross into the next page (which might not be mapped), and the characters past the end of the
+ * line are replaced after loading it. This is how most lines end, and it saves copying the end of
+ * the line. The read is still outside of the line as far as the address sanitizer is concerned, so
+ * it's disabled for this function.
+ */
+__attribute__((no_sanitize_address)) inline void
+config_line_block_load(ConfigLineBlock* block, StringView line, u32 offset)
+{
+    const char* chars = line.chars + offset;
+    u32 length = offset < line.length ? line.length - offset : 0;
+#if defined(__SSE2__)
+    if (length >= CONFIG_LINE_BLOCK_SIZE) {
+        block->chars = _mm_loadu_si128((const __m128i*)(const void*)chars);
+        return;
+    }
+    if (!length) {
+        // Past the end of the line, where there might not be anything to read at all
+        block->chars = _mm_set1_epi8('\n');
+        return;
+    }
+    if (((uintptr_t)chars & (CONFIG_LINE_MIN_PAGE_SIZE - 1)) <= CONFIG_LINE_MIN_PAGE_SIZE - CONFIG_LINE_BLOCK_SIZE) {
+        __m128i loaded = _mm_loadu_si128((const __m128i*)(const void*)chars);
+        __m128i positions = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        __m128i in_line = _mm_cmplt_epi8(positions, _mm_set1_epi8((char)length));
+        block->chars = _mm_or_si128(_mm_and_si128(in_line, loaded), _mm_andnot_si128(in_line, _mm_set1_epi8('\n')));
+        return;
+    }
+    char padded[CONFIG_LINE_BLOCK_SIZE];
+    memset(padded, '\n', CONFIG_LINE_BLOCK_SIZE);
+    memcpy(padded, chars, length);
+    block->chars = _mm_loadu_si128((const __m128i*)(const void*)padded);
+#else
+    memset(block->chars, '\n', CONFIG_LINE_BLOCK_SIZE);
+    memcpy(block->chars, chars, length < CONFIG_LINE_BLOCK_SIZE ? length : CONFIG_LINE_BLOCK_SIZE);
+#endif
+}
+
+/** Returns a mask with bit i set if character i of the block is a space. */
+inline u32
+config_line_block_spaces(const ConfigLineBlock* block)
+{
+#if defined(__SSE2__)
+    return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(block->chars, _mm_set1_epi8(' ')));
+#else
+    u32 mask = 0;
+    for (u32 i = 0; i < CONFIG_LINE_BLOCK_SIZE; i++) {
+        mask |= (u32)char_is(block->chars[i], CharClass_Space) << i;
+    }
+    return mask;
+#endif
+}
+
+/** Returns a mask with bit i set if character i of the block is allowed in identifiers. */
+inline u32
+config_line_block_identifier_chars(const ConfigLineBlock* block)
+{
+#if defined(__SSE2__)
+    // SSE2 only compares signed bytes, so the range checks flip the sign bit of both sides to
+    // compare them as unsigned: (c - 'a') < 26 for letters (with the case folded) and
+    // (c - '0') < 10 for digits
+    const __m128i sign = _mm_set1_epi8((char)0x80);
+    __m128i folded = _mm_or_si128(block->chars, _mm_set1_epi8(0x20));
+    __m128i letter_offset = _mm_xor_si128(_mm_sub_epi8(folded, _mm_set1_epi8('a')), sign);
+    __m128i digit_offset = _mm_xor_si128(_mm_sub_epi8(block->chars, _mm_set1_epi8('0')), sign);
+    __m128i letters = _mm_cmplt_epi8(letter_offset, _mm_set1_epi8((char)(26 ^ 0x80)));
+    __m128i digits = _mm_cmplt_epi8(digit_offset, _mm_set1_epi8((char)(10 ^ 0x80)));
+    __m128i dashes = _mm_cmpeq_epi8(block->chars, _mm_set1_epi8('-'));
+    __m128i underscores = _mm_cmpeq_epi8(block->chars, _mm_set1_epi8('_'));
+    return (u32)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letters, digits), _mm_or_si128(dashes, underscores)));
+#else
+    u32 mask = 0;
+    for (u32 i = 0; i < CONFIG_LINE_BLOCK_SIZE; i++) {
+        mask |= (u32)char_is(block->chars[i], CharClass_Identifier) << i;
+    }
+    return mask;
+#endif
+}
+
+/** Returns the first column at or after 'offset' that isn't a space, or the length of the line. */
+inline u32
+config_line_skip_spaces(StringView line, u32 offset)
+{
+    while (true) {
+        ConfigLineBlock block;
+        config_line_block_load(&block, line, offset);
+        u32 mismatches = ~config_line_block_spaces(&block) & 0xffff;
+        if (mismatches) {
+            return offset + (u32)__builtin_ctz(mismatches);
+        }
+        offset += CONFIG_LINE_BLOCK_SIZE;
+    }
+}
+
+/** Returns the first column at or after 'offset' that isn't an identifier character, or the length of the line. */
+inline u32
+config_line_skip_identifier(StringView line, u32 offset)
+{
+    while (true) {
+        ConfigLineBlock block;
+        config_line_block_load(&block, line, offset);
+        u32 mismatches = ~config_line_block_identifier_chars(&block) & 0xffff;
+        if (mismatches) {
+            return offset + (u32)__builtin_ctz(mismatches);
+        }
+        offset += CONFIG_LINE_BLOCK_SIZE;
+    }
+}
+
+#define CONFIG_LINE_WINDOW_SIZE (2 * CONFIG_LINE_BLOCK_SIZE)
+
+/** The masks of the first CONFIG_LINE_WINDOW_SIZE columns of a line. */
+struct ConfigLineWindow {
+    u32 spaces;
+    u32 identifier_chars;
+};
+
+/**
+ * Returns the first column at or after 'column' that isn't set in the window mask, or
+ * CONFIG_LINE_WINDOW_SIZE if they all are. Since the columns past the end of the line are never
+ * set, the window size is only returned for lines that are at least that long.
+ */
+inline u32
+config_line_window_skip(u32 mask, u32 column)
+{
+    u32 unset = column < CONFIG_LINE_WINDOW_SIZE ? ~mask & (~0u << column) : 0;
+    return unset ? (u32)__builtin_ctz(unset) : CONFIG_LINE_WINDOW_SIZE;
+}
+
+inline u32
+config_line_window_skip_spaces(const ConfigLineWindow* window, StringView line, u32 column)
+{
+    u32 offset = config_line_window_skip(window->spaces, column);
+    return offset < CONFIG_LINE_WINDOW_SIZE ? offset : config_line_skip_spaces(line, column > offset ? column : offset);
+}
+
+/**
+ * Classifies the line (which doesn't include the newline). The columns are only set for action
+ * and variable lines. The value of those can still be invalid (e.g. empty).
+ */
+inline ConfigLineKind
+classify_config_line(StringView line, ConfigLineColumns* columns)
+{
+    ConfigLineWindow window;
+    ConfigLineBlock block;
+    config_line_block_load(&block, line, 0);
+    window.spaces = config_line_block_spaces(&block);
+    window.identifier_chars = config_line_block_identifier_chars(&block);
+    config_line_block_load(&block, line, CONFIG_LINE_BLOCK_SIZE);
+    window.spaces |= config_line_block_spaces(&block) << CONFIG_LINE_BLOCK_SIZE;
+    window.identifier_chars |= config_line_block_identifier_chars(&block) << CONFIG_LINE_BLOCK_SIZE;
+
+    u32 offset = config_line_window_skip_spaces(&window, line, 0);
+    if (offset == line.length) {
+        return ConfigLineKind_Blank;
+    } else if (line.chars[offset] == '#') {
+        return ConfigLineKind_Comment;
+    }
+
+    u32 name_end = config_line_window_skip(window.identifier_chars, offset);
+    if (name_end == CONFIG_LINE_WINDOW_SIZE) {
+        name_end = config_line_skip_identifier(line, offset > name_end ? offset : name_end);
+    }
+    if (name_end == offset) {
+        return ConfigLineKind_Other;
+    }
+    columns->name_start = offset;
+    columns->name_end = name_end;
+
+    ConfigLineKind kind;
+    offset = config_line_window_skip_spaces(&window, line, name_end);
+    if (offset < line.length && line.chars[offset] == '=') {
+        kind = ConfigLineKind_Action;
+        offset += 1;
+    } else if (offset + 1 < line.length && line.chars[offset] == ':' && line.chars[offset + 1] == '=') {
+        kind = ConfigLineKind_Variable;
+        offset += 2;
+    } else {
+        return ConfigLineKind_Other;
+    }
+    columns->value_start = config_line_window_skip_spaces(&window, line, offset);
+    return kind;
+}
@@ -1,132 +1,415 @@
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "chars.h"
+#include "config_cache.h"
+#include "config_lines.h"
 #include "configs.h"
 #include "files.h"
+#include "workers.h"
 
-struct ActionTemplatePair {
-    String action_name = 0;
-    String action_template = 0;
-    ActionTemplatePair* next = 0;
+// The name of the config files in the current directory and the source root
+#define CONFIG_FILE_NAME ".qs.cfg"
+// The name of the directories of config fragments in the current directory and the source root
+#define CONFIG_FRAGMENTS_DIR_NAME ".qs.d"
+// Only the files with this suffix in a fragments directory are loaded
+#define CONFIG_FRAGMENT_SUFFIX ".cfg"
+// The directive that includes another config file ("include <path>")
+#define CONFIG_INCLUDE_DIRECTIVE "include"
+
+/** Returns a new string of the path of the entry 'name' in the directory at 'dir_path'. */
+static String
+path_join(SmallString* storage, const char* dir_path, const char* name)
+{
+    String path = string_new(storage, dir_path);
+    if (!string_len(path) || path[string_len(path) - 1] != '/') {
+        path = string_append(path, '/');
+    }
+    return string_append(path, name);
+}
+
+/**
+ * Adds the config file at 'relative_path' (relative to the current directory) if it's a regular
+ * file. 'dir_path' is the canonical path of the directory that contains it.
+ *
+ * NOTE(christoffer) Since the directory path is canonical, the path of the config only has to be
+ * resolved if the config file itself is a symlink, which saves resolving every path component.
+ */
+static void
+add_config_if_exists(Arena* arena, StringArray* config_files, const char* relative_path, const char* dir_path)
+{
+    struct stat config_stat;
+    if (fstatat(AT_FDCWD, relative_path, &config_stat, AT_SYMLINK_NOFOLLOW) != 0) {
+        return;
+    }
+
+    if (S_ISREG(config_stat.st_mode)) {
+        SmallString config_path_storage;
+        String config_path = path_join(&config_path_storage, dir_path, CONFIG_FILE_NAME);
+        string_array_push(arena, config_files, config_path);
+        string_free(config_path);
+    } else if (S_ISLNK(config_stat.st_mode)) {
+        char resolved_path[PATH_MAX];
+        if (realpath(relative_path, resolved_path) && stat(resolved_path, &config_stat) == 0 && S_ISREG(config_stat.st_mode)) {
+            string_array_push(arena, config_files, resolved_path);
+        }
+    }
+}
+
+// Entries that mark the root of a source tree. '.git' is usually a directory, but it's a file in
+// git worktrees and submodules.
+static const char* const source_root_markers[] = { ".git", ".hg", ".jj" };
+
+static bool
+is_source_root_marker(u32 marker, const struct stat* marker_stat)
+{
+    return S_ISDIR(marker_stat->st_mode) || (marker == 0 && S_ISREG(marker_stat->st_mode));
+}
+
+/**
+ * Paths from the current directory to each of its parent directories, without building a path
+ * for each of them. 'chars' holds 'max_levels' repetitions of "../" followed by an entry name, and
+ * the path for each level is a suffix of it. The name is shared by all levels, and is replaced to
+ * point the paths at a different entry.
+ */
+struct UpPaths {
+    char* chars;
+    u32 max_levels;
 };
 
 static void
-_free_pairs(ActionTemplatePair* head)
+up_paths_init(Arena* arena, UpPaths* up_paths, const char* cwd_path)
 {
-    ActionTemplatePair* pair = head;
-    while (pair) {
-        string_free(pair->action_name);
-        string_free(pair->action_template);
-        ActionTemplatePair* dead = pair;
-        pair = pair->next;
-        free(dead);
+    // Every component of the path is a level that can be walked up
+    u32 cwd_len = cstrlen(cwd_path);
+    u32 max_levels = 0;
+    for (u32 i = 1; i < cwd_len; i++) {
+        max_levels += cwd_path[i] == '/';
+    }
+    max_levels += cwd_len > 1;
+
+    // The longest name is the config file name
+    up_paths->max_levels = max_levels;
+    up_paths->chars = ARENA_ALLOC(arena, char, max_levels * 3 + sizeof(CONFIG_FILE_NAME));
+    for (u32 i = 0; i < max_levels; i++) {
+        memcpy(up_paths->chars + i * 3, "../", 3);
     }
 }
 
-static String
-find_source_root_dir(const char* start_path)
+/** Points the paths at the entry 'name' in each directory, and returns the path for 'level'. */
+static const char*
+up_path(UpPaths* up_paths, u32 level, const char* name)
 {
-    String curpath = string_new(start_path);
-    u32 curpath_len = string_len(curpath);
+    u32 name_size = cstrlen(name) + 1;
+    assert(name_size <= sizeof(CONFIG_FILE_NAME));
+    memcpy(up_paths->chars + up_paths->max_levels * 3, name, name_size);
+    return up_paths->chars + (up_paths->max_levels - level) * 3;
+}
 
-    // Only look for .git directories. Other source roots TBD
-    char wanted_entry[] = "/.git";
+/**
+ * Looks for the closest parent directory of the current directory (or the current directory
+ * itself) that is a source root. Returns the number of levels up from the current directory, or
+ * -1 if there isn't a source root.
+ *
+ * The stamp of every directory that was searched is written to 'stamps', which must have room for
+ * max_levels + 1 stamps. Returns -2 if a directory couldn't be stamped (the stamps are incomplete).
+ */
+static s32
+find_source_root_level(UpPaths* up_paths, DirStamp* stamps, u32* num_stamps)
+{
+    *num_stamps = 0;
+    for (u32 level = 0; level <= up_paths->max_levels; level++) {
+        struct stat entry_stat;
+        if (fstatat(AT_FDCWD, up_path(up_paths, level, "."), &entry_stat, 0) != 0) {
+            return -2;
+        }
+        dir_stamp_set(stamps + (*num_stamps)++, &entry_stat);
 
-    bool found_source_root = false;
-    String candidate = string_new();
-    while (!found_source_root) {
-        candidate = string_copy(candidate, curpath);
-        candidate = string_append(candidate, wanted_entry);
-        if (is_readable_dir(candidate)) {
-            found_source_root = true;
-            break;
+        for (u32 marker = 0; marker < sizeof(source_root_markers) / sizeof(source_root_markers[0]); marker++) {
+            const char* candidate = up_path(up_paths, level, source_root_markers[marker]);
+            if (fstatat(AT_FDCWD, candidate, &entry_stat, 0) == 0 && is_source_root_marker(marker, &entry_stat)) {
+                return (s32)level;
+            }
         }
+    }
+    return -1;
+}
 
-        if (curpath_len == 0) {
-            break;
+/** Returns true if none of the directories that the discovery searched has changed since. */
+static bool
+discovery_is_valid(UpPaths* up_paths, const DiscoveredConfigs* discovered)
+{
+    if (discovered->num_stamps == 0 || discovered->num_stamps > up_paths->max_levels + 1) {
+        return false;
+    }
+    for (u32 level = 0; level < discovered->num_stamps; level++) {
+        struct stat dir_stat;
+        if (fstatat(AT_FDCWD, up_path(up_paths, level, "."), &dir_stat, 0) != 0 || !dir_stamp_matches(discovered->stamps + level, &dir_stat)) {
+            return false;
         }
+    }
+    return true;
+}
 
-        // move curpath up one level and check again
-        while (curpath_len--) {
-            if (curpath[curpath_len] == '/') {
-                curpath[curpath_len] = '\0';
-                break;
+/** An entry of a fragments directory that is (or links to) a config fragment. */
+struct ConfigFragment {
+    String name;
+    bool is_link;
+};
+
+static int
+compare_fragments(const void* a, const void* b)
+{
+    return strcmp(((const ConfigFragment*)a)->name, ((const ConfigFragment*)b)->name);
+}
+
+/**
+ * Adds the config fragments in the directory at 'relative_dir_path' (relative to the current
+ * directory, or absolute). 'dir_path' is the canonical path of the directory, or 0 if it has to
+ * be resolved (which is only done if the directory exists).
+ *
+ * The fragments are the regular files (or symlinks to them) with the CONFIG_FRAGMENT_SUFFIX,
+ * except for hidden files. They're added in reverse name order, so that (as is conventional for
+ * conf.d directories) a fragment overrides the fragments whose names sort before it. The order
+ * doesn't depend on the order of the directory entries.
+ */
+static void
+add_config_fragments(Arena* arena, StringArray* config_files, const char* relative_dir_path, const char* dir_path)
+{
+    int dir_fd = open(relative_dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return;
+    }
+    DIR* dir = fdopendir(dir_fd);
+    if (!dir) {
+        close(dir_fd);
+        return;
+    }
+
+    u32 num_fragments = 0;
+    u32 fragments_capacity = 0;
+    ConfigFragment* fragments = 0;
+    u32 suffix_len = cstrlen(CONFIG_FRAGMENT_SUFFIX);
+    while (struct dirent* entry = readdir(dir)) {
+        u32 name_len = cstrlen(entry->d_name);
+        if (entry->d_name[0] == '.' || name_len <= suffix_len || !string_eq(entry->d_name + name_len - suffix_len, CONFIG_FRAGMENT_SUFFIX)) {
+            continue;
+        }
+
+        // Not all file systems report the type of the entries
+        u8 type = entry->d_type;
+        struct stat entry_stat;
+        if (type == DT_UNKNOWN && fstatat(dir_fd, entry->d_name, &entry_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+            type = S_ISREG(entry_stat.st_mode) ? DT_REG : S_ISLNK(entry_stat.st_mode) ? DT_LNK : DT_UNKNOWN;
+        }
+        if (type != DT_REG && type != DT_LNK) {
+            continue;
+        }
+
+        if (num_fragments == fragments_capacity) {
+            fragments_capacity = fragments_capacity ? fragments_capacity * 2 : 16;
+            ConfigFragment* grown = ARENA_ALLOC(arena, ConfigFragment, fragments_capacity);
+            if (num_fragments) {
+                memcpy(grown, fragments, num_fragments * sizeof(ConfigFragment));
             }
+            fragments = grown;
         }
+        fragments[num_fragments].name = string_new(arena, entry->d_name);
+        fragments[num_fragments].is_link = type == DT_LNK;
+        num_fragments++;
+    }
+    closedir(dir);
 
-        if (curpath_len == 0) {
-            break;
+    char resolved_dir_path[PATH_MAX];
+    if (!num_fragments || (!dir_path && !realpath(relative_dir_path, resolved_dir_path))) {
+        return;
+    }
+    dir_path = dir_path ? dir_path : resolved_dir_path;
+
+    qsort(fragments, num_fragments, sizeof(ConfigFragment), compare_fragments);
+    for (u32 i = num_fragments; i > 0; i--) {
+        ConfigFragment* fragment = fragments + i - 1;
+        SmallString fragment_path_storage;
+        String fragment_path = path_join(&fragment_path_storage, dir_path, fragment->name);
+        if (!fragment->is_link) {
+            string_array_push(arena, config_files, fragment_path);
+        } else {
+            char resolved_path[PATH_MAX];
+            struct stat fragment_stat;
+            if (realpath(fragment_path, resolved_path) && stat(resolved_path, &fragment_stat) == 0 && S_ISREG(fragment_stat.st_mode)) {
+                string_array_push(arena, config_files, resolved_path);
+            }
+        }
+        string_free(fragment_path);
+    }
+}
+
+/**
+ * Returns a new string of the path of the directory 'level' levels up from the current directory,
+ * by removing the last 'level' components of its path.
+ */
+static String
+up_dir_path(SmallString* storage, const char* cwd_path, s32 level)
+{
+    u32 dir_len = cstrlen(cwd_path);
+    for (s32 i = 0; i < level; i++) {
+        while (dir_len && cwd_path[--dir_len] != '/')
+            ;
+    }
+    // Walking up to the file system root leaves the root itself
+    dir_len = dir_len ? dir_len : 1;
+    String dir_path = string_new(storage, cwd_path);
+    set_string_len(dir_path, dir_len);
+    dir_path[dir_len] = '\0';
+    return dir_path;
+}
+
+/**
+ * Searches the current directory and its parent directories for the config files of the source
+ * tree. Returns false if the result can't be cached (a directory couldn't be stamped).
+ */
+static bool
+discover_source_tree_configs(Arena* arena, UpPaths* up_paths, const char* cwd_path, DiscoveredConfigs* discovered)
+{
+    *discovered = {};
+    StringArray found = {};
+
+    /* Resolve cwd config */
+    add_config_if_exists(arena, &found, CONFIG_FILE_NAME, cwd_path);
+    if (found.count) {
+        discovered->cwd_config = found.items[0];
+    }
+
+    /* Resolve source root config */
+    DirStamp* stamps = ARENA_ALLOC(arena, DirStamp, up_paths->max_levels + 1);
+    s32 level = find_source_root_level(up_paths, stamps, &discovered->num_stamps);
+    discovered->stamps = stamps;
+    discovered->source_root_level = level >= 0 ? level : -1;
+
+    // NOTE(christoffer) If the cwd is the source root, then we'll add the same file twice.
+    // While it has no functional difference, we'd like to avoid the unnecessery work, so
+    // we skip the source root in this case and rely on the cwd config being picked up in
+    // a subsequent step.
+    if (level > 0) {
+        SmallString source_root_storage;
+        String source_root = up_dir_path(&source_root_storage, cwd_path, level);
+        u32 num_found = found.count;
+        add_config_if_exists(arena, &found, up_path(up_paths, (u32)level, CONFIG_FILE_NAME), source_root);
+        if (found.count > num_found) {
+            discovered->source_root_config = found.items[num_found];
         }
+        string_free(source_root);
     }
-    string_free(candidate);
+    return level != -2;
+}
 
-    if (found_source_root) {
-        return curpath;
+/**
+ * Returns true if the config file found in the directory at 'dir_path' (if any) is still there.
+ *
+ * NOTE(christoffer) Adding or removing a config file changes the directory that it's in, so the
+ * directory stamps cover the config files that are in the searched directories. But they don't
+ * cover the targets of symlinked config files, which can be removed without changing any of the
+ * searched directories, so those are checked on their own.
+ */
+static bool
+discovered_config_exists(const char* config_path, const char* dir_path)
+{
+    if (!config_path) {
+        return true;
     }
+    SmallString found_path_storage;
+    String found_path = path_join(&found_path_storage, dir_path, CONFIG_FILE_NAME);
+    bool is_symlinked = !string_eq(found_path, config_path);
+    string_free(found_path);
 
-    string_free(curpath);
-    return 0;
+    struct stat config_stat;
+    return !is_symlinked || (stat(config_path, &config_stat) == 0 && S_ISREG(config_stat.st_mode));
+}
+
+/** Returns true if the config files found by the discovery are all still there. */
+static bool
+discovered_configs_exist(const char* cwd_path, const DiscoveredConfigs* discovered)
+{
+    if (!discovered_config_exists(discovered->cwd_config, cwd_path)) {
+        return false;
+    }
+    if (!discovered->source_root_config) {
+        return true;
+    }
+    SmallString source_root_storage;
+    String source_root = up_dir_path(&source_root_storage, cwd_path, discovered->source_root_level);
+    bool exists = discovered_config_exists(discovered->source_root_config, source_root);
+    string_free(source_root);
+    return exists;
 }
 
 /**
- * Allocates memory for a new node and it's content. Appends to the given end node (if set)
- * and returns the the new end (the new node)
+ * Adds the config files in the current directory and its source root (in that order), each
+ * followed by the fragments in the CONFIG_FRAGMENTS_DIR_NAME directory next to it.
+ *
+ * Where the config files are is cached, and as long as none of the searched directories have
+ * changed, the next run only has to check the directories instead of searching them. The
+ * fragments directories are always listed, since adding a fragment doesn't change the directory
+ * that the fragments directory is in.
  */
-static StringList*
-push_back_dup(StringList** head, StringList* end, const char* content)
+static void
+resolve_source_tree_config_files(Arena* arena, StringArray* config_files, const char* cwd_path)
 {
-    StringList* node = ALLOC(StringList, 1);
-    node->string = string_new(content);
-    node->next = 0;
+    UpPaths up_paths;
+    up_paths_init(arena, &up_paths, cwd_path);
 
-    if (end) {
-        end->next = node;
+    DiscoveredConfigs discovered = {};
+    if (
+        !discovery_cache_load(arena, cwd_path, &discovered)
+        || !discovery_is_valid(&up_paths, &discovered)
+        || !discovered_configs_exist(cwd_path, &discovered)) {
+        if (discover_source_tree_configs(arena, &up_paths, cwd_path, &discovered)) {
+            discovery_cache_store(cwd_path, &discovered);
+        }
     }
 
-    if (*head == 0) {
-        *head = node;
+    if (discovered.cwd_config) {
+        string_array_push(arena, config_files, discovered.cwd_config);
     }
+    SmallString fragments_dir_storage;
+    String fragments_dir = path_join(&fragments_dir_storage, cwd_path, CONFIG_FRAGMENTS_DIR_NAME);
+    add_config_fragments(arena, config_files, CONFIG_FRAGMENTS_DIR_NAME, fragments_dir);
+    string_free(fragments_dir);
 
-    return node;
+    s32 level = discovered.source_root_level;
+    if (level > 0 && (u32)level <= up_paths.max_levels) {
+        if (discovered.source_root_config) {
+            string_array_push(arena, config_files, discovered.source_root_config);
+        }
+        SmallString source_root_storage;
+        String source_root = up_dir_path(&source_root_storage, cwd_path, level);
+        SmallString root_fragments_dir_storage;
+        String root_fragments_dir = path_join(&root_fragments_dir_storage, source_root, CONFIG_FRAGMENTS_DIR_NAME);
+        add_config_fragments(arena, config_files, up_path(&up_paths, (u32)level, CONFIG_FRAGMENTS_DIR_NAME), root_fragments_dir);
+        string_free(root_fragments_dir);
+        string_free(source_root);
+    }
 }
 
-StringList*
-resolve_default_config_files()
+void resolve_default_config_files(Arena* arena, StringArray* config_files)
 {
     /**
      * NOTE(christoffer) The order in which we resolve these is significant. The resulting list will
      * processed from start to end, and the first action match is the one that's picked.
      */
-    StringList* head = 0;
-    StringList* end = head;
-
-    /* Resolve cwd config */
-    {
-        char local_config_path[PATH_MAX];
-        if (realpath("./.qs.cfg", local_config_path) && is_readable_regfile(local_config_path)) {
-            end = push_back_dup(&head, end, local_config_path);
-        }
-    }
 
-    /* Resolve source root config */
-    {
-        char cwd_path[PATH_MAX];
-        String source_root;
-        if (realpath(".", cwd_path) && (source_root = find_source_root_dir(cwd_path))) {
-            // NOTE(christoffer) If the cwd is the source root, then we'll add the same file twice.
-            // While it has no functional difference, we'd like to avoid the unnecessery work, so
-            // we skip the source root in this case and rely on the cwd config being picked up in
-            // a subsequent step.
-            if (!string_eq(cwd_path, source_root)) {
-                source_root = string_append(source_root, "/.qs.cfg");
-                if (is_readable_regfile(source_root)) {
-                    end = push_back_dup(&head, end, source_root);
-                }
-            }
-            string_free(source_root);
-        }
+    // The canonical path of the current directory. All other candidates in the source tree are
+    // checked relative to the current directory, so this is the only path that's resolved.
+    char cwd_path[PATH_MAX];
+    if (getcwd(cwd_path, sizeof(cwd_path))) {
+        resolve_source_tree_config_files(arena, config_files, cwd_path);
     }
 
     /* Resolve config config file in XDG_CONFIG_HOME */
@@ -136,320 +419,1074 @@ resolve_default_config_files()
         // https://wiki.archlinux.org/index.php/XDG_Base_Directory
         char* xdg_config_home_env = getenv("XDG_CONFIG_HOME");
 
+        SmallString xdg_config_home_dir_storage;
         String xdg_config_home_dir = 0;
         if (xdg_config_home_env) {
             // User has set a non-default directory. Use that as the base.
-            xdg_config_home_dir = string_new(xdg_config_home_env);
+            xdg_config_home_dir = string_new(&xdg_config_home_dir_storage, xdg_config_home_env);
         } else {
             // Fall back to the default config home directory of $HOME/.config
             char* home = getenv("HOME");
             if (home) {
-                xdg_config_home_dir = string_new(home);
+                xdg_config_home_dir = string_new(&xdg_config_home_dir_storage, home);
                 xdg_config_home_dir = string_append(xdg_config_home_dir, "/.config");
             }
         }
 
         if (xdg_config_home_dir) {
-            String default_config_path = string_new(xdg_config_home_dir);
+            SmallString default_config_path_storage;
+            String default_config_path = string_new(&default_config_path_storage, xdg_config_home_dir);
             default_config_path = string_append(default_config_path, "/qs/default.cfg");
-            string_free(xdg_config_home_dir);
 
+            // Check that the config exists before resolving it, which takes a syscall per component
+            struct stat default_config_stat;
             char resolved_default_config_path[PATH_MAX];
             if (
-                realpath(default_config_path, resolved_default_config_path)
-                && is_readable_regfile(resolved_default_config_path)) {
-                end = push_back_dup(&head, end, resolved_default_config_path);
+                stat(default_config_path, &default_config_stat) == 0
+                && S_ISREG(default_config_stat.st_mode)
+                && realpath(default_config_path, resolved_default_config_path)) {
+                string_array_push(arena, config_files, resolved_default_config_path);
             }
             string_free(default_config_path);
+
+            // The fragments in the conf.d directory next to the default config
+            SmallString fragments_dir_storage;
+            String fragments_dir = string_new(&fragments_dir_storage, xdg_config_home_dir);
+            fragments_dir = string_append(fragments_dir, "/qs/conf.d");
+            add_config_fragments(arena, config_files, fragments_dir, 0);
+            string_free(fragments_dir);
+            string_free(xdg_config_home_dir);
         }
     }
+}
 
-    return head;
+/** Returns the character at 'offset', or %nul past the end of the line. */
+static char
+char_at(StringView line, u32 offset)
+{
+    return offset < line.length ? line.chars[offset] : '\0';
 }
 
 static u32
-skip_whitespace(u32 start, String content)
+skip_whitespace(u32 start, StringView line)
 {
-    u32 offset = start;
-    u32 content_len = string_len(content);
-    while ((offset < content_len) && (content[offset] == ' ')) {
-        offset++;
-    }
-    return offset;
+    return scan_while<CharClass_Space>(line.chars, start, line.length);
 }
 
 static u32
-read_identifier(u32 start, String content, String* value)
+read_identifier(u32 start, StringView line, StringView* value)
 {
-    u32 offset = start;
-    u32 content_len = string_len(content);
-    while ((offset < content_len) && is_identifier_char(content[offset])) {
-        offset++;
-    }
+    u32 offset = scan_while<CharClass_Identifier>(line.chars, start, line.length);
     if (offset > start) {
-        *value = string_copy(*value, (content + start), offset - start);
+        *value = string_view(line.chars + start, offset - start);
     }
     return offset;
 }
 
-static u32
-read_until_newline(u32 start, String content, String* value)
+/** A message (error or warning) about a config file. */
+struct ConfigMessage {
+    FILE* stream;
+    char* text;
+};
+
+/** The messages about a config file that have been held back (see print_config_message()). */
+struct ConfigMessages {
+    u32 count = 0;
+    u32 capacity = 0;
+    ConfigMessage* items = 0;
+};
+
+// Set while a config file is loaded on a worker thread
+static __thread ConfigMessages* held_config_messages = 0;
+
+/**
+ * Prints a message about the config file that's being loaded.
+ *
+ * NOTE(christoffer) Config files that are loaded in parallel hold their messages back until
+ * they're added to the index (see print_held_config_messages()), so that the messages come out in
+ * priority order, and only for the config files that would have been loaded one by one.
+ */
+__attribute__((format(printf, 2, 3))) static void
+print_config_message(FILE* stream, const char* format, ...)
 {
-    u32 offset = start;
-    while (offset < string_len(content) && content[offset] != '\n') {
-        offset++;
+    va_list args;
+    va_start(args, format);
+    if (!held_config_messages) {
+        vfprintf(stream, format, args);
+        va_end(args);
+        return;
+    }
+
+    va_list size_args;
+    va_copy(size_args, args);
+    int length = vsnprintf(0, 0, format, size_args);
+    va_end(size_args);
+    char* text = ALLOC(char, (u32)length + 1);
+    assert(text);
+    vsnprintf(text, (size_t)length + 1, format, args);
+    va_end(args);
+
+    ConfigMessages* messages = held_config_messages;
+    if (messages->count == messages->capacity) {
+        messages->capacity = messages->capacity ? messages->capacity * 2 : 4;
+        messages->items = (ConfigMessage*)realloc(messages->items, messages->capacity * sizeof(ConfigMessage));
+        assert(messages->items);
     }
-    if (value && (offset > start)) {
-        *value = string_copy(*value, (content + start), offset - start);
+    messages->items[messages->count].stream = stream;
+    messages->items[messages->count].text = text;
+    messages->count++;
+}
+
+/** Prints the messages that were held back (if 'print' is set), and frees them. */
+static void
+print_held_config_messages(ConfigMessages* messages, bool print)
+{
+    for (u32 i = 0; i < messages->count; i++) {
+        if (print) {
+            fputs(messages->items[i].text, messages->items[i].stream);
+        }
+        free(messages->items[i].text);
     }
-    return offset;
+    free(messages->items);
+    *messages = {};
 }
 
 static ActionTemplatePair*
-remove_duplicate_actions(ActionTemplatePair* pairs, const char* filepath)
+remove_duplicate_actions(Arena* arena, ActionTemplatePair* pairs, const char* filepath, bool* found_duplicates)
 {
+    // The action names are interned, so the handles can index a table of seen actions directly
+    bool* seen_actions = ARENA_ALLOC(arena, bool, intern_count() + 1);
+
     ActionTemplatePair *head = pairs, *node = head, *prev = 0;
-    StringList* seen_actions = 0;
     while (node) {
-        if (string_list_contains(seen_actions, node->action_name)) {
-            fprintf(stdout, "Warning: duplicate action name: %s (in %s)\n", node->action_name, filepath);
+        if (seen_actions[node->name]) {
+            print_config_message(stdout, "Warning: duplicate action name: %s (in %s)\n", node->action_name, filepath);
+            *found_duplicates = true;
 
             // prev should always have been set, can't detect dupes withouth checking
             // at least two
             assert(prev);
 
-            // Take the current 'node' out of the list and kill it
+            // Take the current 'node' out of the list (it's released together with the arena)
             prev->next = node->next;
-            ActionTemplatePair* dead = node;
             node = node->next;
-            string_free(dead->action_name);
-            string_free(dead->action_template);
-            free(dead);
         } else {
-            seen_actions = string_list_add_front_dup(seen_actions, node->action_name);
+            seen_actions[node->name] = true;
             prev = node;
             node = node->next;
         }
     }
-    string_list_free(seen_actions);
     return head;
 }
 
 static void
 print_error(const char* message, const char* filepath)
 {
-    fprintf(stderr, "Error in %s: %s\n", filepath, message);
+    print_config_message(stderr, "Error in %s: %s\n", filepath, message);
+}
+
+/**
+ * Reads the value of an action or variable line (see classify_config_line()), and reports the
+ * error if it's invalid. Returns false if it is.
+ */
+static bool
+read_declaration_value(StringView line, const ConfigLineColumns* columns, bool is_variable, const char* filepath, StringView* value)
+{
+    u32 offset = columns->value_start;
+
+    // Special case. We don't allow the value to start with a comment because it's
+    // a bit ambiguous: "action = # is this a value or comment?"
+    if (char_at(line, offset) == '#') {
+        print_error(is_variable ? "Argument value cannot start with '#'" : "Action template cannot start with '#'", filepath);
+        return false;
+    }
+
+    if (offset == line.length) {
+        print_error(is_variable ? "No value after ':='" : "No value after '='", filepath);
+        return false;
+    }
+
+    *value = string_view(line.chars + offset, line.length - offset);
+    return true;
+}
+
+/**
+ * Adds the path of the include directive on the line to 'includes'. Returns false if the line
+ * isn't an include directive.
+ */
+static bool
+read_include_directive(Arena* arena, StringView line, StringArray* includes)
+{
+    StringView identifier = {};
+    u32 offset = skip_whitespace(0, line);
+    u32 identifier_end = read_identifier(offset, line, &identifier);
+    offset = skip_whitespace(identifier_end, line);
+    if (identifier_end == offset || offset == line.length || !string_view_eq(identifier, CONFIG_INCLUDE_DIRECTIVE)) {
+        return false;
+    }
+
+    // The path is the rest of the line, without trailing whitespace
+    u32 path_end = line.length;
+    while (line.chars[path_end - 1] == ' ') {
+        path_end--;
+    }
+    String include_path = string_new(arena, string_view(line.chars + offset, path_end - offset));
+    string_array_push(arena, includes, include_path);
+    return true;
 }
 
+/**
+ * Parses the config file, line by line. The resulting action pairs and include paths are
+ * allocated from the arena, while the variables are owned by the caller.
+ */
 static bool
-parse_config(const char* filepath, ActionTemplatePair** result_pairs, VarList** result_vars)
+parse_config(Arena* arena, const char* filepath, ActionTemplatePair** result_pairs, VarMap* result_vars, StringArray* result_includes, bool* result_had_warnings)
 {
-    String filecontent;
-    if (!(filecontent = read_entire_file(filepath))) {
+    LineReader reader;
+    if (!line_reader_open(filepath, &reader)) {
+        print_config_message(stderr, "Warning: Failed to open file %s\n", filepath);
         print_error("Failed to read config file. Aborting", filepath);
-        string_free(filecontent);
         return false;
     }
-    u32 content_len = string_len(filecontent);
 
     // The head, and the tail of the pair list
     ActionTemplatePair* head = 0;
     ActionTemplatePair* end = 0;
 
     // The list of variables declared in the config file
-    VarList* vars = 0;
+    VarMap vars = {};
+
+    // The paths of the included config files, as written in the config file
+    StringArray includes = {};
 
     // Error flag set if the config file is invalid
     bool error = false;
 
-    // Temporary storage variable for various values
-    String value = string_new();
-
-    // The parsed variable name to read a value for
-    String pending_var_name = string_new();
-
-    // The parse action name to read a template for
-    String pending_action_name = string_new();
-
-    // Offset into filecontent buffer we're currently reading
-    u32 offset = 0;
-
-    // Speculative offset after attempting to parse a certain sequence of bytes
-    // (e.g. an identifier). We keep this separate to be able to compare them
-    // in order to detect if the sequence was read or not.
-    u32 new_offset = 0;
+    // The identifiers and values are views into the line, and are only copied once they're added
+    // to the parsed actions or variables.
+    StringView line = {};
+    StringView identifier = {};
 
     // Parse the config linewise
-    while (offset < content_len) {
-        string_clear(pending_var_name);
-        string_clear(pending_action_name);
-
-        // Chew up any leading whitespace of the line
-        offset = skip_whitespace(offset, filecontent);
-
-        // Inspect the first non-whitespace content of the line
-        if (!filecontent[offset]) {
-            // EOF
-            break;
-        } else if (filecontent[offset] == '#') {
-            // Rest of the line is a comment
-            offset = read_until_newline(offset, filecontent, 0);
-        } else if (filecontent[offset] == '\n') {
-            // Empty-, or whitespace only line
-            offset++;
-        } else if ((new_offset = read_identifier(offset, filecontent, &value)) > offset) {
-            // Found and parsed an identifier. We expect it to be followed by either
-            // - a ':=' (if it's a variable definition)
-            // - a '=' (if it's an action definition)
-            offset = new_offset;
-            offset = skip_whitespace(offset, filecontent);
+    while (line_reader_next(&reader, &line)) {
+        // Most lines are blank, comments, actions or variables, and for those the classification
+        // finds all the columns that are needed (see config_lines.h)
+        ConfigLineColumns columns;
+        ConfigLineKind kind = classify_config_line(line, &columns);
+        if (kind == ConfigLineKind_Blank || kind == ConfigLineKind_Comment) {
+            continue;
+        } else if (kind == ConfigLineKind_Other) {
+            // Chew up any leading whitespace of the line
+            u32 offset = skip_whitespace(0, line);
 
-            if (
-                ((offset + 1) < content_len)
-                && filecontent[offset] == ':'
-                && filecontent[offset + 1] == '=') {
-                // Variable (:=) declaration
-                offset += 2; // eat :=
-                pending_var_name = string_copy(pending_var_name, value);
-            } else if (filecontent[offset] == '=') {
-                // Action (=) declaration
-                offset += 1; // eat =
-                pending_action_name = string_copy(pending_action_name, value);
-            } else {
-                print_error("Expected '=' or ':='", filepath);
-                error = true;
-                offset = read_until_newline(offset, filecontent, 0);
-                continue;
+            // Inspect the first non-whitespace content of the line
+            if (!line.chars[offset]) {
+                // NOTE(christoffer) A %nul at the start of a line ends the config, like the end of
+                // the file does
+                break;
             }
 
-            // Eat whitespace after the =/:= and then parse the rest of the line as the value
-            offset = skip_whitespace(offset, filecontent);
-
-            // Special case. We don't allow the value to start with a comment because it's
-            // a bit ambiguous: "action = # is this a value or comment?"
-            if (filecontent[offset] == '#') {
-                if (string_len(pending_action_name)) {
-                    print_error("Action template cannot start with '#'", filepath);
-                } else if (string_len(pending_var_name)) {
-                    print_error("Argument value cannot start with '#'", filepath);
-                } else {
-                    assert(false);
-                }
+            u32 identifier_end = read_identifier(offset, line, &identifier);
+            if (identifier_end == offset) {
+                char errormsg[50] = { 0 };
+                snprintf(errormsg, 50, "Unexpected character '%c' (%d)", line.chars[offset], line.chars[offset]);
+                print_error(errormsg, filepath);
                 error = true;
-                offset = read_until_newline(offset, filecontent, 0);
                 continue;
             }
 
-            if ((new_offset = read_until_newline(offset, filecontent, &value)) > offset) {
-                // Got value, decide what the assign it to based on which pending variable
-                // that was set.
-                if (string_len(pending_var_name)) {
-                    // Parsed a variable name at the start of the line, set the value
-                    vars = template_set(vars, pending_var_name, value);
-                } else if (string_len(pending_action_name)) {
-                    ActionTemplatePair* node = ALLOC(ActionTemplatePair, 1);
-                    assert(node);
-                    node->action_name = string_new(pending_action_name);
-                    node->action_template = string_new(value);
-                    head = head ? head : node;
-                    if (end)
-                        end->next = node;
-                    end = node;
-                } else {
-                    // Should always have gotten a var, action, or an error (that continues)
-                    assert(false);
-                }
-
-                offset = new_offset;
-            } else {
-                if (string_len(pending_action_name)) {
-                    print_error("No value after '='", filepath);
-                } else if (string_len(pending_var_name)) {
-                    print_error("No value after ':='", filepath);
-                } else {
-                    assert(false);
-                }
+            // Found and parsed an identifier. Since the line isn't an action (=) or a variable
+            // (:=) declaration, it has to be an include directive (followed by whitespace and a path)
+            if (!read_include_directive(arena, line, &includes)) {
+                print_error("Expected '=' or ':='", filepath);
                 error = true;
-                offset = read_until_newline(offset, filecontent, 0);
-                continue;
             }
+            continue;
+        }
 
-            // There shouldn't be a case where we didn't deplete the line or content
-            assert((filecontent[offset] == '\n') || (filecontent[offset] == '\0'));
-        } else {
-            char errormsg[50] = { 0 };
-            snprintf(errormsg, 50, "Unexpected character '%c' (%d)", filecontent[offset], filecontent[offset]);
-            print_error(errormsg, filepath);
+        bool is_variable = kind == ConfigLineKind_Variable;
+        StringView value = {};
+        if (!read_declaration_value(line, &columns, is_variable, filepath, &value)) {
             error = true;
-            offset = read_until_newline(offset, filecontent, 0);
             continue;
         }
+
+        identifier = string_view(line.chars + columns.name_start, columns.name_end - columns.name_start);
+        if (is_variable) {
+            template_set(&vars, identifier, value);
+        } else {
+            ActionTemplatePair* node = ARENA_ALLOC(arena, ActionTemplatePair, 1);
+            node->name = intern(identifier);
+            node->action_name = string_new(arena, identifier);
+            node->action_template = string_new(arena, value);
+            head = head ? head : node;
+            if (end)
+                end->next = node;
+            end = node;
+        }
     }
 
-    // Free temporary data used during parsing
-    string_free(filecontent);
-    string_free(value);
-    string_free(pending_action_name);
-    string_free(pending_var_name);
+    if (reader.failed) {
+        print_error("Failed to read config file. Aborting", filepath);
+        error = true;
+    }
+    line_reader_close(&reader);
 
     if (error) {
-        _free_pairs(head);
-        template_free(vars);
+        template_free(&vars);
         return false;
     } else {
-        head = remove_duplicate_actions(head, filepath);
+        head = remove_duplicate_actions(arena, head, filepath, result_had_warnings);
         *result_pairs = head;
         *result_vars = vars;
+        *result_includes = includes;
         return true;
     }
 }
 
-bool config_get_action_names(char* config_file_path, StringList** action_names)
+/** The state of scanning a config file for a single action (see scan_config()). */
+struct ConfigScan {
+    Arena* arena = 0;
+    const char* filepath = 0;
+    StringView action_name = {};
+
+    ActionTemplatePair* action = 0;
+    VarMap vars = {};
+    StringArray includes = {};
+
+    // Set once the rest of the config file can't change the result
+    bool done = false;
+    bool error = false;
+};
+
+/** Returns the line around the character at 'c' in 'lines' (which are separated by newlines). */
+static StringView
+line_around(StringView lines, const char* c)
 {
-    StringList* found_action_names = 0;
+    const char* start = c;
+    while (start > lines.chars && start[-1] != '\n') {
+        start--;
+    }
+    const char* end = (const char*)memchr(c, '\n', (size_t)(lines.chars + lines.length - c));
+    end = end ? end : lines.chars + lines.length;
+    return string_view(start, (u32)(end - start));
+}
+
+/** Returns true if 'c' can be the start of an identifier at the start of a line, going by the character before it. */
+static bool
+can_start_line_identifier(StringView lines, const char* c)
+{
+    return c == lines.chars || c[-1] == '\n' || c[-1] == ' ';
+}
+
+/**
+ * Scans the lines for the declaration of the action, the variables and the include directives.
+ * Only the lines that contain the action name, a ':=' or the include directive are looked at (the
+ * lines are found with memmem()), and only those are parsed. Their order is kept for each kind of
+ * line, which is all that matters for the result.
+ */
+static void
+scan_config_lines(ConfigScan* scan, StringView lines)
+{
+    // NOTE(christoffer) A %nul at the start of a line ends the config (see parse_config())
+    for (const char* c = (const char*)memchr(lines.chars, '\0', lines.length); c; c = (const char*)memchr(c + 1, '\0', (size_t)(lines.chars + lines.length - c - 1))) {
+        StringView line = line_around(lines, c);
+        if (line.chars + skip_whitespace(0, line) == c) {
+            lines.length = (u32)(line.chars - lines.chars);
+            scan->done = true;
+            break;
+        }
+    }
+    const char* lines_end = lines.chars + lines.length;
+
+    // The first declaration of the action is the one that's used. The others are duplicates, which
+    // are warned about like when parsing the config file in full (see remove_duplicate_actions()).
+    StringView name = scan->action_name;
+    const char* c = lines.chars;
+    while ((c = (const char*)memmem(c, (size_t)(lines_end - c), name.chars, name.length))) {
+        StringView line = line_around(lines, c);
+        ConfigLineColumns columns;
+        if (
+            can_start_line_identifier(lines, c)
+            && classify_config_line(line, &columns) == ConfigLineKind_Action
+            && line.chars + columns.name_start == c
+            && columns.name_end - columns.name_start == name.length) {
+            StringView value = {};
+            if (!read_declaration_value(line, &columns, false, scan->filepath, &value)) {
+                scan->error = true;
+                return;
+            }
+            if (scan->action) {
+                print_config_message(stdout, "Warning: duplicate action name: %s (in %s)\n", scan->action->action_name, scan->filepath);
+            } else {
+                scan->action = ARENA_ALLOC(scan->arena, ActionTemplatePair, 1);
+                scan->action->name = intern(name);
+                scan->action->action_name = string_new(scan->arena, name);
+                scan->action->action_template = string_new(scan->arena, value);
+            }
+        }
+        c = line.chars + line.length;
+    }
+
+    // The variables are all needed, since the template can reference any of them. The first ':='
+    // of a variable line is always the one after the name.
+    c = lines.chars;
+    while ((c = (const char*)memmem(c, (size_t)(lines_end - c), ":=", 2))) {
+        StringView line = line_around(lines, c);
+        ConfigLineColumns columns;
+        if (classify_config_line(line, &columns) == ConfigLineKind_Variable) {
+            StringView value = {};
+            if (!read_declaration_value(line, &columns, true, scan->filepath, &value)) {
+                scan->error = true;
+                return;
+            }
+            template_set(&scan->vars, string_view(line.chars + columns.name_start, columns.name_end - columns.name_start), value);
+        }
+        c = line.chars + line.length;
+    }
+
+    c = lines.chars;
+    u32 directive_length = (u32)strlen(CONFIG_INCLUDE_DIRECTIVE);
+    while ((c = (const char*)memmem(c, (size_t)(lines_end - c), CONFIG_INCLUDE_DIRECTIVE, directive_length))) {
+        StringView line = line_around(lines, c);
+        ConfigLineColumns columns;
+        if (can_start_line_identifier(lines, c) && classify_config_line(line, &columns) == ConfigLineKind_Other) {
+            read_include_directive(scan->arena, line, &scan->includes);
+        }
+        c = line.chars + line.length;
+    }
+}
+
+/**
+ * Scans the config file for the declaration of a single action, without parsing the whole file
+ * (see scan_config_lines()). The result is the same as parsing it in full and keeping just the
+ * action, as long as the config file is valid, but only the lines that declare the action, the
+ * variables, or include other config files are validated. The others are left to a full parse
+ * (see action_index_check()).
+ *
+ * The whole config file is scanned even once the action has been found, since variables can be
+ * declared anywhere in it, and later declarations of the action are warned about as duplicates.
+ */
+static bool
+scan_config(Arena* arena, const char* filepath, NameId wanted_action, ActionTemplatePair** result_pairs, VarMap* result_vars, StringArray* result_includes)
+{
+    LineReader reader;
+    if (!line_reader_open(filepath, &reader)) {
+        print_config_message(stderr, "Warning: Failed to open file %s\n", filepath);
+        print_error("Failed to read config file. Aborting", filepath);
+        return false;
+    }
+
+    ConfigScan scan = {};
+    scan.arena = arena;
+    scan.filepath = filepath;
+    scan.action_name = intern_view(wanted_action);
+
+    StringView lines = {};
+    while (!scan.done && !scan.error && line_reader_next_lines(&reader, &lines)) {
+        scan_config_lines(&scan, lines);
+    }
+
+    if (reader.failed) {
+        print_error("Failed to read config file. Aborting", filepath);
+        scan.error = true;
+    }
+    line_reader_close(&reader);
+
+    if (scan.error) {
+        template_free(&scan.vars);
+        return false;
+    }
+    *result_pairs = scan.action;
+    *result_vars = scan.vars;
+    *result_includes = scan.includes;
+    return true;
+}
+
+/** Stats the config file, printing an error if it can't be read. */
+static bool
+stat_config_file(const char* filepath, struct stat* source_stat)
+{
+    if (stat(filepath, source_stat) != 0) {
+        print_error("Failed to read config file. Aborting", filepath);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Returns true if the compiled form of the config file was mapped from the cache, which it is if
+ * the config file hasn't changed since it was last compiled.
+ */
+static bool
+load_cached_config(const struct stat* source_stat, CompiledConfig* config)
+{
+    // Only regular files can be identified by their stat, the content of a pipe (or any other
+    // special file) can change without it changing
+    return S_ISREG(source_stat->st_mode) && config_cache_load(source_stat, config);
+}
+
+/**
+ * Parses and compiles a config file that isn't cached ('source_stat' is its stat), and writes the
+ * result to the cache for subsequent runs.
+ *
+ * Config files that can't be cached, or that are CONFIG_SCANNED_LOOKUP_SIZE or larger, are only
+ * scanned for the action when looking for a single one ('wanted_action'), and only that action is
+ * compiled (see scan_config()). Parsing them in full would be wasted, since the result isn't kept
+ * for subsequent runs, and the memory stays bounded no matter the size of the file.
+ *
+ * The arena is only used for scratch memory while parsing, and is reset before returning.
+ *
+ * Returns true if successful, false if the config file couldn't be read or parsed.
+ */
+static bool
+compile_config_file(Arena* arena, const char* filepath, const struct stat* source_stat, NameId wanted_action, CompiledConfig* config)
+{
+    bool cacheable = S_ISREG(source_stat->st_mode);
+
+    // Parse the config in full if it can be cached, so that later runs don't have to
+    bool scan = wanted_action && (!cacheable || source_stat->st_size >= CONFIG_SCANNED_LOOKUP_SIZE);
+    cacheable = cacheable && !scan;
+
+    ArenaMark scratch_mark = arena_mark(arena);
     ActionTemplatePair* pairs = 0;
-    VarList* vars = 0;
+    VarMap vars = {};
+    StringArray includes = {};
+    bool had_warnings = false;
+    bool parsed = scan ? scan_config(arena, filepath, wanted_action, &pairs, &vars, &includes) : parse_config(arena, filepath, &pairs, &vars, &includes, &had_warnings);
+    if (!parsed) {
+        arena_reset(arena, scratch_mark);
+        return false;
+    }
+
+    bool compiled = compile_config(source_stat, pairs, &vars, &includes, config);
+    arena_reset(arena, scratch_mark);
+    template_free(&vars);
+
+    if (!compiled) {
+        print_error("Config file is too large. Aborting", filepath);
+        return false;
+    }
+
+    // Don't cache configs with warnings (e.g. duplicate actions). The warnings are only printed
+    // while parsing, and we want them to show up until they've been fixed.
+    if (cacheable && !had_warnings) {
+        config_cache_store(config);
+    }
+    return true;
+}
+
+/**
+ * Loads the compiled form of a config file, from the cache if possible (see load_cached_config()),
+ * otherwise by compiling it (see compile_config_file()).
+ *
+ * Returns true if successful, false if the config file couldn't be read or parsed.
+ */
+static bool
+load_compiled_config(Arena* arena, const char* filepath, NameId wanted_action, CompiledConfig* config)
+{
+    struct stat source_stat;
+    if (!stat_config_file(filepath, &source_stat)) {
+        return false;
+    }
+    return load_cached_config(&source_stat, config) || compile_config_file(arena, filepath, &source_stat, wanted_action, config);
+}
 
-    if (parse_config(config_file_path, &pairs, &vars)) {
-        ActionTemplatePair* pair = pairs;
-        while (pair) {
-            found_action_names = string_list_add_front_dup(found_action_names, pair->action_name);
-            pair = pair->next;
+/** Makes sure the index has room for 'count' more config files. */
+static void
+reserve_index_configs(ActionIndex* index, u32 count)
+{
+    u32 required = index->num_configs + count;
+    if (required <= index->configs_capacity) {
+        return;
+    }
+    u32 capacity = index->configs_capacity ? index->configs_capacity : 8;
+    while (capacity < required) {
+        capacity *= 2;
+    }
+
+    index->config_paths = (String*)realloc(index->config_paths, capacity * sizeof(String));
+    index->configs = (CompiledConfig*)realloc(index->configs, capacity * sizeof(CompiledConfig));
+    index->config_states = (ConfigLoadState*)realloc(index->config_states, capacity * sizeof(ConfigLoadState));
+    index->config_parents = (u32*)realloc(index->config_parents, capacity * sizeof(u32));
+    index->config_ids = (ConfigFileId*)realloc(index->config_ids, capacity * sizeof(ConfigFileId));
+    index->config_messages = (ConfigMessages*)realloc(index->config_messages, capacity * sizeof(ConfigMessages));
+    assert(index->config_paths && index->configs && index->config_states && index->config_parents && index->config_ids && index->config_messages);
+    index->configs_capacity = capacity;
+}
+
+/**
+ * Inserts a config file at 'position' in the priority order, moving the config files from there
+ * on one step down. Only config files that haven't been added to the index can be moved.
+ */
+static void
+insert_index_config(ActionIndex* index, u32 position, String path, u32 parent, ConfigFileId id)
+{
+    assert(position >= index->num_loaded_configs && position <= index->num_configs);
+    reserve_index_configs(index, 1);
+
+    u32 num_moved = index->num_configs - position;
+    memmove(index->config_paths + position + 1, index->config_paths + position, num_moved * sizeof(String));
+    memmove(index->configs + position + 1, index->configs + position, num_moved * sizeof(CompiledConfig));
+    memmove(index->config_states + position + 1, index->config_states + position, num_moved * sizeof(ConfigLoadState));
+    memmove(index->config_parents + position + 1, index->config_parents + position, num_moved * sizeof(u32));
+    memmove(index->config_ids + position + 1, index->config_ids + position, num_moved * sizeof(ConfigFileId));
+    memmove(index->config_messages + position + 1, index->config_messages + position, num_moved * sizeof(ConfigMessages));
+    index->num_configs++;
+
+    // Parents are stored as positions, so the ones pointing at moved configs have to follow them
+    for (u32 i = 0; i < index->num_configs; i++) {
+        if (index->config_parents[i] >= position) {
+            index->config_parents[i]++;
+        }
+    }
+
+    index->config_paths[position] = path;
+    index->configs[position] = {};
+    index->config_states[position] = ConfigLoadState_Pending;
+    index->config_parents[position] = parent;
+    index->config_ids[position] = id;
+    index->config_messages[position] = {};
+}
+
+/**
+ * Moves the config at 'from' up to 'position' (before it), making it a child of 'parent'. The
+ * configs in between move on one step down. It's kept as is otherwise, so a config that was loaded
+ * as part of an earlier batch doesn't have to be loaded again.
+ */
+static void
+move_index_config(ActionIndex* index, u32 from, u32 position, u32 parent)
+{
+    assert(position >= index->num_loaded_configs && position <= from && from < index->num_configs);
+
+    String path = index->config_paths[from];
+    CompiledConfig config = index->configs[from];
+    ConfigLoadState state = index->config_states[from];
+    ConfigFileId id = index->config_ids[from];
+    ConfigMessages messages = index->config_messages[from];
+
+    u32 num_moved = from - position;
+    memmove(index->config_paths + position + 1, index->config_paths + position, num_moved * sizeof(String));
+    memmove(index->configs + position + 1, index->configs + position, num_moved * sizeof(CompiledConfig));
+    memmove(index->config_states + position + 1, index->config_states + position, num_moved * sizeof(ConfigLoadState));
+    memmove(index->config_parents + position + 1, index->config_parents + position, num_moved * sizeof(u32));
+    memmove(index->config_ids + position + 1, index->config_ids + position, num_moved * sizeof(ConfigFileId));
+    memmove(index->config_messages + position + 1, index->config_messages + position, num_moved * sizeof(ConfigMessages));
+
+    for (u32 i = 0; i < index->num_configs; i++) {
+        if (index->config_parents[i] == from) {
+            index->config_parents[i] = position;
+        } else if (index->config_parents[i] >= position && index->config_parents[i] < from) {
+            index->config_parents[i]++;
         }
-        _free_pairs(pairs);
-        template_free(vars);
-        *action_names = found_action_names;
-        return true;
     }
 
+    index->config_paths[position] = path;
+    index->configs[position] = config;
+    index->config_states[position] = state;
+    index->config_parents[position] = parent;
+    index->config_ids[position] = id;
+    index->config_messages[position] = messages;
+}
+
+void action_index_init(ActionIndex* index, StringArray* config_files, Arena* arena)
+{
+    *index = {};
+    index->arena = arena;
+    reserve_index_configs(index, config_files->count);
+    for (u32 i = 0; i < config_files->count; i++) {
+        ConfigFileId unknown_id = {};
+        insert_index_config(index, i, config_files->items[i], i, unknown_id);
+    }
+}
+
+/**
+ * Returns the table slot for the action name. This is either the slot holding the action with
+ * that name, or the empty slot where it would be inserted.
+ */
+static u32
+find_index_slot(ActionIndex* index, NameId name)
+{
+    u32 mask = index->table_capacity - 1;
+    u32 slot = intern_hash(name) & mask;
+    while (index->table[slot] && index->actions[index->table[slot] - 1].name != name) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/** Makes sure the index has room for 'count' more actions, rehashing the table if necessary. */
+static void
+reserve_index_actions(ActionIndex* index, u32 count)
+{
+    u32 required = index->num_actions + count;
+    if (required > index->actions_capacity) {
+        u32 capacity = index->actions_capacity ? index->actions_capacity : 16;
+        while (capacity < required) {
+            capacity *= 2;
+        }
+        index->actions = (IndexedAction*)realloc(index->actions, capacity * sizeof(IndexedAction));
+        assert(index->actions);
+        index->actions_capacity = capacity;
+    }
+
+    // Keep the table at most half full
+    if (required * 2 > index->table_capacity) {
+        u32 capacity = index->table_capacity ? index->table_capacity : 32;
+        while (capacity < required * 2) {
+            capacity *= 2;
+        }
+        free(index->table);
+        index->table = ALLOC(u32, capacity);
+        assert(index->table);
+        index->table_capacity = capacity;
+        for (u32 i = 0; i < index->num_actions; i++) {
+            index->table[find_index_slot(index, index->actions[i].name)] = i + 1;
+        }
+    }
+}
+
+/** Returns true if the compiled config declares the action. */
+static bool
+config_declares_action(const CompiledConfig* config, StringView action_name)
+{
+    for (u32 i = 0; i < config->num_actions; i++) {
+        String name = compiled_config_string(config, config->actions[i].name_offset);
+        if (string_len(name) == action_name.length && memcmp(name, action_name.chars, action_name.length) == 0) {
+            return true;
+        }
+    }
     return false;
 }
 
-ResolvedTemplateResult
-resolve_template_for_action(char* config_file_path, char* action_name)
+struct ConfigBatch {
+    ActionIndex* index;
+    u32 first_config;
+    // The stat of the first config file, which has already been looked up in the cache
+    const struct stat* first_stat;
+    NameId wanted_action;
+    // The config files after this one aren't needed when looking for the wanted action, since
+    // this one declares it or failed to load (either ends the lookup). Lowered as the config files
+    // are loaded, by any of the threads.
+    u32 last_needed_config;
+};
+
+static void
+load_batch_config(void* batch_ptr, u32 task_index)
 {
-    ActionTemplatePair* pairs = 0;
-    VarList* vars = 0;
-
-    ResolvedTemplateResult result = {};
-
-    if (parse_config(config_file_path, &pairs, &vars)) {
-        ActionTemplatePair* pair = pairs;
-        bool found = false;
-        while (pair) {
-            if (string_eq(pair->action_name, action_name)) {
-                result.action_template = string_new(pair->action_template);
-                result.vars = template_merge(0, vars);
-                found = true;
-                break;
+    ConfigBatch* batch = (ConfigBatch*)batch_ptr;
+    ActionIndex* index = batch->index;
+    u32 config_index = batch->first_config + task_index;
+    if (index->config_states[config_index] != ConfigLoadState_Pending || config_index > __atomic_load_n(&batch->last_needed_config, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // The index arena can't be shared between threads, so every config gets its own scratch arena
+    Arena scratch = {};
+    CompiledConfig* config = index->configs + config_index;
+    held_config_messages = index->config_messages + config_index;
+    const char* filepath = index->config_paths[config_index];
+    bool loaded = config_index == batch->first_config ? compile_config_file(&scratch, filepath, batch->first_stat, batch->wanted_action, config) : load_compiled_config(&scratch, filepath, batch->wanted_action, config);
+    held_config_messages = 0;
+    arena_release(&scratch);
+    index->config_states[config_index] = loaded ? ConfigLoadState_Loaded : ConfigLoadState_Failed;
+
+    if (batch->wanted_action && (!loaded || config_declares_action(config, intern_view(batch->wanted_action)))) {
+        u32 last_needed = __atomic_load_n(&batch->last_needed_config, __ATOMIC_RELAXED);
+        while (config_index < last_needed && !__atomic_compare_exchange_n(&batch->last_needed_config, &last_needed, config_index, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+/**
+ * Loads the config file at 'first_config'. If it has to be parsed (it isn't cached), the config
+ * files after it that haven't been loaded yet are loaded too, all of them in parallel. They're
+ * only added to the index one by one, in priority order (see load_next_config()).
+ *
+ * When looking for the wanted action, the config files that haven't been started on once a
+ * config file with higher priority turns out to declare the action (or fails to load) are
+ * skipped. They're left to be loaded when they're needed.
+ */
+static void
+load_config_batch(ActionIndex* index, u32 first_config, NameId wanted_action)
+{
+    // NOTE(christoffer) Cached config files are only mapped, which is cheaper than starting
+    // threads, so they're loaded right away, one at a time
+    const char* first_path = index->config_paths[first_config];
+    struct stat first_stat;
+    if (!stat_config_file(first_path, &first_stat)) {
+        index->config_states[first_config] = ConfigLoadState_Failed;
+        return;
+    }
+    if (load_cached_config(&first_stat, index->configs + first_config)) {
+        index->config_states[first_config] = ConfigLoadState_Loaded;
+        return;
+    }
+
+    u32 num_pending = 0;
+    for (u32 i = first_config; i < index->num_configs; i++) {
+        num_pending += index->config_states[i] == ConfigLoadState_Pending;
+    }
+    if (num_pending == 1) {
+        bool loaded = compile_config_file(index->arena, first_path, &first_stat, wanted_action, index->configs + first_config);
+        index->config_states[first_config] = loaded ? ConfigLoadState_Loaded : ConfigLoadState_Failed;
+        return;
+    }
+
+    ConfigBatch batch = {};
+    batch.index = index;
+    batch.first_config = first_config;
+    batch.first_stat = &first_stat;
+    batch.wanted_action = wanted_action;
+    batch.last_needed_config = index->num_configs - 1;
+    workers_run(index->num_configs - first_config, load_batch_config, &batch);
+}
+
+/** Returns true if the config file with 'id' is the config at 'config_index', or (transitively) includes it. */
+static bool
+is_included_by(ActionIndex* index, u32 config_index, ConfigFileId id)
+{
+    while (true) {
+        ConfigFileId* includer_id = index->config_ids + config_index;
+        if (includer_id->dev == id.dev && includer_id->ino == id.ino) {
+            return true;
+        }
+        if (index->config_parents[config_index] == config_index) {
+            return false;
+        }
+        config_index = index->config_parents[config_index];
+    }
+}
+
+/**
+ * Returns the position of the config file with 'id' in the index, or num_configs if it isn't in
+ * the index.
+ *
+ * The config files of the search list are only identified once they're loaded, so the ones that
+ * haven't been loaded yet are identified here (they might be included before their turn).
+ */
+static u32
+find_config_file(ActionIndex* index, ConfigFileId id)
+{
+    for (u32 i = 0; i < index->num_configs; i++) {
+        struct stat config_stat;
+        if (!index->config_ids[i].ino && stat(index->config_paths[i], &config_stat) == 0) {
+            index->config_ids[i].dev = (u64)config_stat.st_dev;
+            index->config_ids[i].ino = (u64)config_stat.st_ino;
+        }
+        if (index->config_ids[i].ino == id.ino && index->config_ids[i].dev == id.dev) {
+            return i;
+        }
+    }
+    return index->num_configs;
+}
+
+/**
+ * Inserts the config files included by the config at 'config_index' right after it, in the order
+ * that they're included. They're loaded next, so their actions have the priority of the including
+ * config file, and are shadowed by the ones it declares itself. The paths are relative to the
+ * directory of the including config file.
+ *
+ * NOTE(christoffer) Config files are identified by their inode, and a config file that has
+ * already been added to the index with a higher priority (by another include, or as part of the
+ * search list) isn't added again. One that comes later in the search list is moved up instead,
+ * since the include gives it a higher priority. This way each file is parsed at most once, even
+ * if several config files include it.
+ *
+ * Returns false if a config file includes itself (directly or through other includes).
+ */
+static bool
+add_config_includes(ActionIndex* index, u32 config_index)
+{
+    u32 num_added = 0;
+    for (u32 i = 0; i < index->configs[config_index].num_includes; i++) {
+        // Inserting configs moves the configs array, so the included path is looked up every time
+        const CompiledConfig* config = index->configs + config_index;
+        String include = compiled_config_string(config, config->includes[i]);
+        const char* config_path = index->config_paths[config_index];
+
+        SmallString include_path_storage;
+        String include_path = string_new(&include_path_storage, config_path);
+        const char* config_name = strrchr(config_path, '/');
+        u32 dir_len = include[0] != '/' && config_name ? (u32)(config_name - config_path) + 1 : 0;
+        set_string_len(include_path, dir_len);
+        include_path[dir_len] = '\0';
+        include_path = string_append(include_path, include);
+
+        // Included files that don't exist are still added, so that loading them reports the error
+        char resolved_path[PATH_MAX];
+        struct stat include_stat;
+        ConfigFileId id = {};
+        const char* path = include_path;
+        if (realpath(include_path, resolved_path) && stat(resolved_path, &include_stat) == 0) {
+            path = resolved_path;
+            id.dev = (u64)include_stat.st_dev;
+            id.ino = (u64)include_stat.st_ino;
+
+            if (is_included_by(index, config_index, id)) {
+                char errormsg[PATH_MAX + 32] = { 0 };
+                snprintf(errormsg, sizeof(errormsg), "Include cycle through %s", resolved_path);
+                print_error(errormsg, config_path);
+                string_free(include_path);
+                return false;
             }
-            pair = pair->next;
         }
-        _free_pairs(pairs);
-        template_free(vars);
-    } else {
-        result.parse_error = true;
+
+        u32 position = config_index + 1 + num_added;
+        u32 existing = id.ino ? find_config_file(index, id) : index->num_configs;
+        if (existing == index->num_configs) {
+            insert_index_config(index, position, string_new(index->arena, path), config_index, id);
+            num_added++;
+        } else if (existing >= position) {
+            move_index_config(index, existing, position, config_index);
+            num_added++;
+        }
+        string_free(include_path);
     }
+    return true;
+}
+
+/**
+ * Adds the actions of the next config file (in priority order) to the index, loading it first
+ * if it hasn't been loaded as part of an earlier batch. Actions that are already declared by a
+ * config file with higher priority are shadowed, and skipped. The config files that it includes
+ * are added after it.
+ *
+ * If 'wanted_action' is set, only that action might be added for config files that are scanned
+ * for it rather than parsed (see compile_config_file()).
+ *
+ * Returns false if the config couldn't be read or parsed.
+ */
+static bool
+load_next_config(ActionIndex* index, NameId wanted_action)
+{
+    assert(index->num_loaded_configs < index->num_configs);
+    u32 config_index = index->num_loaded_configs++;
+    CompiledConfig* config = index->configs + config_index;
+
+    if (index->config_states[config_index] == ConfigLoadState_Pending) {
+        load_config_batch(index, config_index, wanted_action);
+    }
+    print_held_config_messages(index->config_messages + config_index, true);
+    if (index->config_states[config_index] == ConfigLoadState_Failed) {
+        return false;
+    }
+    ConfigFileId* id = index->config_ids + config_index;
+    compiled_config_source(config, &id->dev, &id->ino);
+
+    // The actions run from the directory of the config file in the search list that (possibly
+    // through other config files) included the config file
+    u32 root_config_index = config_index;
+    while (index->config_parents[root_config_index] != root_config_index) {
+        root_config_index = index->config_parents[root_config_index];
+    }
+
+    reserve_index_actions(index, config->num_actions);
+    for (u32 i = 0; i < config->num_actions; i++) {
+        String action_name = compiled_config_string(config, config->actions[i].name_offset);
+        NameId name = intern(string_view(action_name, string_len(action_name)));
+        u32 slot = find_index_slot(index, name);
+        if (!index->table[slot]) {
+            IndexedAction* action = index->actions + index->num_actions++;
+            action->name = name;
+            action->action_name = action_name;
+            action->action_template = compiled_config_string(config, config->actions[i].value_offset);
+            action->config_index = config_index;
+            action->root_config_index = root_config_index;
+            index->table[slot] = index->num_actions;
+        }
+    }
+    return add_config_includes(index, config_index);
+}
+
+const IndexedAction*
+action_index_find(ActionIndex* index, const char* action_name, bool* parse_error)
+{
+    *parse_error = false;
+    NameId name = intern(action_name);
+    while (true) {
+        if (index->table_capacity) {
+            u32 slot = find_index_slot(index, name);
+            if (index->table[slot]) {
+                return index->actions + index->table[slot] - 1;
+            }
+        }
 
-    return result;
+        if (index->num_loaded_configs == index->num_configs) {
+            return 0;
+        }
+
+        // Not declared in any of the configs loaded so far, keep looking in the next one
+        if (!load_next_config(index, name)) {
+            *parse_error = true;
+            return 0;
+        }
+    }
+}
+
+bool action_index_load_next(ActionIndex* index, bool* loaded)
+{
+    if (index->num_loaded_configs == index->num_configs) {
+        return false;
+    }
+    // The included config files are added after the config file, so its position stays the same
+    u32 config_index = index->num_loaded_configs;
+    load_next_config(index, 0);
+    *loaded = index->config_states[config_index] == ConfigLoadState_Loaded;
+    return true;
+}
+
+bool action_index_check(ActionIndex* index)
+{
+    // Without a wanted action, every config file that isn't cached is parsed in full
+    bool valid = true;
+    while (index->num_loaded_configs < index->num_configs) {
+        valid = load_next_config(index, 0) && valid;
+    }
+    return valid;
+}
+
+static char*
+lookup_config_var(const void* source, NameId name)
+{
+    return compiled_config_get_var((const CompiledConfig*)source, name);
+}
+
+void action_index_var_scope(ActionIndex* index, const IndexedAction* action, VarScope* scope)
+{
+    // The scope of each config file in the include chain, from the one that declared the action
+    // (the innermost scope) to the one in the search list (the outermost scope, 'scope')
+    u32 depth = 0;
+    for (u32 i = action->config_index; index->config_parents[i] != i; i = index->config_parents[i]) {
+        depth++;
+    }
+    VarScope* inner_scopes = depth ? ARENA_ALLOC(index->arena, VarScope, depth) : 0;
+
+    u32 config_index = action->config_index;
+    for (u32 level = 0; level <= depth; level++) {
+        VarScope* level_scope = level == depth ? scope : inner_scopes + level;
+        *level_scope = {};
+        level_scope->lookup = lookup_config_var;
+        level_scope->source = index->configs + config_index;
+        level_scope->parent = level ? inner_scopes + level - 1 : 0;
+        config_index = index->config_parents[config_index];
+    }
+}
+
+void action_index_free(ActionIndex* index)
+{
+    for (u32 i = 0; i < index->num_configs; i++) {
+        compiled_config_free(index->configs + i);
+        // The config files that were loaded in parallel, but turned out not to be needed
+        print_held_config_messages(index->config_messages + i, false);
+    }
+    free(index->config_paths);
+    free(index->configs);
+    free(index->config_states);
+    free(index->config_parents);
+    free(index->config_ids);
+    free(index->config_messages);
+    free(index->actions);
+    free(index->table);
+    *index = {};
 }
@@ -2,56 +2,157 @@
 
 #include <limits.h>
 
+#include "arena.h"
 #include "base.h"
+#include "intern.h"
 #include "string.h"
 #include "templates.h"
 
-enum TokenType {
-    TokenType_Undefined = 0,
-    TokenType_Whitespace,
-    TokenType_NewLine,
-    TokenType_Comment,
-    TokenType_ActionName,
-    TokenType_Equal,
-    TokenType_Template,
-    TokenType_Invalid,
+// Config files of at least this size are scanned for the action rather than compiled in full when
+// looking up a single action (see action_index_find())
+#define CONFIG_SCANNED_LOOKUP_SIZE (256 * 1024 * 1024)
+
+struct ActionTemplatePair {
+    NameId name = 0;
+    String action_name = 0;
+    String action_template = 0;
+    ActionTemplatePair* next = 0;
 };
 
-struct Token {
-    TokenType type = TokenType_Undefined;
-    u32 start = 0;
-    u32 end = 0;
+struct CompiledConfig;
+struct ConfigMessages;
+
+enum ConfigLoadState {
+    ConfigLoadState_Pending = 0,
+    ConfigLoadState_Loaded,
+    ConfigLoadState_Failed,
 };
 
-struct ResolvedTemplateResult {
+/** An action in the ActionIndex. The strings point into the compiled config that declared the action. */
+struct IndexedAction {
+    NameId name = 0;
+    String action_name = 0;
     String action_template = 0;
-    VarList* vars = 0;
-    bool parse_error = false;
+    // Position of the declaring config file in ActionIndex::config_paths
+    u32 config_index = 0;
+    // Position of the config file from the search list that declared the action, or included the
+    // config file that did (possibly through other included config files). The action runs from
+    // the directory of this config file.
+    u32 root_config_index = 0;
+};
+
+/** Identifies a config file by its device and inode. A zero inode means unknown. */
+struct ConfigFileId {
+    u64 dev = 0;
+    u64 ino = 0;
+};
+
+/**
+ * The actions declared across all config files, built once per invocation.
+ *
+ * Config files are loaded lazily in priority order, and each file is parsed at most once. An
+ * action declared in more than one config file is only indexed for the config file with the
+ * highest priority (the others are shadowed).
+ *
+ * Once a config file that isn't cached is needed, it's parsed in parallel with the config files
+ * after it (see load_config_batch() in configs.cpp). Their actions are still indexed in priority
+ * order, and their errors and warnings are printed in that order, so the result is the same as
+ * loading them one by one.
+ *
+ * The config files included by a config file ("include <path>") are added to the index right
+ * after it, once it's loaded. Each physical config file is added at most once.
+ */
+struct ActionIndex {
+    // Arena for the per-config arrays below, and scratch memory while parsing config files
+    Arena* arena = 0;
+
+    // The config files in priority order, including the included ones. The paths of the config
+    // files in the search list are borrowed from the array given to action_index_init() and must
+    // outlive the index.
+    u32 num_configs = 0;
+    u32 configs_capacity = 0;
+    String* config_paths = 0;
+    CompiledConfig* configs = 0;
+    ConfigLoadState* config_states = 0;
+    // The position of the config file that included each config file, or the position of the
+    // config file itself if it's from the search list
+    u32* config_parents = 0;
+    // The identity of each config file, once it's known (see ConfigFileId)
+    ConfigFileId* config_ids = 0;
+    // The errors and warnings of the config files that were loaded in parallel, until they're
+    // added to the index
+    ConfigMessages* config_messages = 0;
+
+    // The config files up to this position have been added to the index. The ones after it might
+    // have been loaded already, as part of a batch (see 'config_states').
+    u32 num_loaded_configs = 0;
+
+    // All non-shadowed actions, ordered by config priority and then declaration order
+    u32 num_actions = 0;
+    u32 actions_capacity = 0;
+    IndexedAction* actions = 0;
+
+    // Open addressing hash table of positions in 'actions' (plus one, 0 marks an empty slot)
+    u32 table_capacity = 0;
+    u32* table = 0;
 };
 
 /**
  * Loop through a list of default configuration file locations, and add each existing one to
- * the privided string list. Only adds existing files that can be read.
+ * the privided string array. Only adds existing files that can be read.
+ *
+ * Each config file location can be followed by a directory of config fragments (.qs.d next to
+ * .qs.cfg, and conf.d next to the default config), which are added right after it. Fragments are
+ * ordered by name, and a fragment takes priority over the ones whose names sort before it.
  *
  * The paths are searched in order of priority. This means that the configration file to search
  * first is added fist to the list. It's assumed that the list already contains configuration files
  * with higher priority than any one added by this function.
+ *
+ * The paths are allocated from the arena.
  */
-StringList* resolve_default_config_files();
+void resolve_default_config_files(Arena* arena, StringArray* config_files);
 
 /**
- * Parses the config file and writes all action names to 'action_names'.
- * Returns true if the config file was successfully parsed, false otherwise (no result
- * will be written in this case).
+ * Sets up an (empty) index for the config files in 'config_files', ordered by priority. The index
+ * allocates from the arena, which must outlive it.
  */
-bool config_get_action_names(char* config_file_path, StringList** action_names);
+void action_index_init(ActionIndex* index, StringArray* config_files, Arena* arena);
 
 /**
- * Resolves a template string for given action by parsing a list of config
- * files. The order of the config files is significant, as the first matched
- * action is the one resolved.
+ * Finds the action with the given name, loading config files in priority order until it's found.
+ *
+ * Config files that can't be cached (e.g. pipes) and config files of CONFIG_SCANNED_LOOKUP_SIZE or
+ * more are only scanned for the lines that can declare the action, and only the action with the
+ * given name is added to the index for them. The reading stops early if possible. The rest of the
+ * lines of those config files aren't validated (see action_index_check()).
  *
- * Returns a ResolveTemplateRes enum value which indicates the resolution (found, not found or error).
- * The resolved template string is written to 'resolved_template' only if the return value is found.
+ * Returns 0 if no config file declares the action, or if a config file that had to be searched
+ * failed to load (in which case 'parse_error' is set).
+ */
+const IndexedAction* action_index_find(ActionIndex* index, const char* action_name, bool* parse_error);
+
+/**
+ * Loads the next config file (in priority order) into the index. Config files that fail to load
+ * are skipped. Sets 'loaded' if the config file was loaded, and returns false once every config
+ * file has been loaded already.
  */
-ResolvedTemplateResult resolve_template_for_action(char* config_file_path, char* action_name);
+bool action_index_load_next(ActionIndex* index, bool* loaded);
+
+/**
+ * Loads all config files into the index, parsing every one of them in full (except for the ones
+ * that are loaded from the cache, which are known to be valid), and reports their errors.
+ * Returns true if all of them are valid.
+ */
+bool action_index_check(ActionIndex* index);
+
+/**
+ * Sets up 'scope' to look up the default variables declared in the config file of the action.
+ * If the config file was included, the variables declared by the config files that included it
+ * take precedence over its own. The variables are read straight from the compiled configs, so the
+ * scope is only valid until more config files are loaded into the index.
+ */
+void action_index_var_scope(ActionIndex* index, const IndexedAction* action, VarScope* scope);
+
+/** Frees all resources claimed by the index (including the compiled configs), except for arena memory. */
+void action_index_free(ActionIndex* index);
@@ -1,55 +1,170 @@
 #include <assert.h>
-#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "files.h"
 
-String
-read_entire_file(const char* filepath)
+// Mapping a file costs more than reading it for small files (the mapping has to be set up, and
+// every page faults on its first access), so only files of at least this size are mapped. Files
+// larger than the max size are streamed instead, to keep them from being mapped in full.
+#define MMAP_MIN_SIZE (64 * 1024)
+#define MMAP_MAX_SIZE (64 * 1024 * 1024)
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+bool line_reader_open(const char* filepath, LineReader* reader)
 {
     assert(filepath);
+    *reader = {};
 
-    FILE* fp;
-    fp = fopen(filepath, "r");
-    if (!fp) {
-        fprintf(stderr, "Warning: Failed to open file %s\n", filepath);
-        return 0;
+    int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
     }
 
-    fseek(fp, 0, SEEK_END);
-    u32 filesize = ftell(fp);
-    rewind(fp);
+    struct stat file_stat;
+    if (
+        fstat(fd, &file_stat) == 0
+        && S_ISREG(file_stat.st_mode)
+        && file_stat.st_size >= MMAP_MIN_SIZE
+        && file_stat.st_size <= MMAP_MAX_SIZE) {
+        void* mapping = mmap(0, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            // The lines are read in a single pass from the start to the end of the file
+            madvise(mapping, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            reader->mapping = mapping;
+            reader->mapping_size = (u64)file_stat.st_size;
+            reader->chars = (char*)mapping;
+            reader->end = reader->mapping_size;
+            reader->at_eof = true;
+            return true;
+        }
+    }
 
-    String result = string_new();
-    result = string_ensure_fits_len(result, filesize);
-    u32 bytes_read = fread(result, sizeof(char), filesize, fp);
-    fclose(fp);
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    reader->fd = fd;
+    reader->capacity = READ_CHUNK_SIZE;
+    reader->chars = ALLOC(char, reader->capacity);
+    assert(reader->chars);
+    return true;
+}
 
-    if (bytes_read != filesize) {
-        fprintf(stderr, "Warning: Failed to read file %s\n", filepath);
-        string_free(result);
-        return 0;
-    } else {
-        set_string_len(result, filesize);
-        result[filesize] = '\0';
+/*
+ * Reads the next chunk of the file into the buffer. The unconsumed data is moved to the front of
+ * the buffer first, and the buffer only grows if that data (a partial line) fills all of it.
+ */
+static bool
+fill_buffer(LineReader* reader)
+{
+    if (reader->start > 0) {
+        memmove(reader->chars, reader->chars + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    if (reader->end == reader->capacity) {
+        if (reader->capacity > LINE_READER_MAX_LINE_LENGTH) {
+            return false;
+        }
+        reader->capacity *= 2;
+        reader->chars = (char*)realloc(reader->chars, reader->capacity);
+        assert(reader->chars);
+    }
+
+    while (true) {
+        ssize_t n = read(reader->fd, reader->chars + reader->end, reader->capacity - reader->end);
+        if (n >= 0) {
+            reader->end += (u64)n;
+            reader->at_eof = n == 0;
+            return true;
+        } else if (errno != EINTR) {
+            return false;
+        }
     }
-    return result;
 }
 
-bool is_readable_regfile(const char* path)
+bool line_reader_next(LineReader* reader, StringView* line)
 {
-    struct stat file_stat;
-    // NOTE(christoffer) stat should follow symlinks, which we want
-    bool is_regfile = (stat(path, &file_stat) == 0 && S_ISREG(file_stat.st_mode));
-    bool is_readable = access(path, F_OK) != -1;
-    return is_regfile && is_readable;
+    while (!reader->failed) {
+        char* begin = reader->chars + reader->start;
+        u64 available = reader->end - reader->start;
+        char* newline = (char*)memchr(begin + reader->scanned, '\n', available - reader->scanned);
+        if (newline || (reader->at_eof && available)) {
+            u64 length = newline ? (u64)(newline - begin) : available;
+            if (length > LINE_READER_MAX_LINE_LENGTH) {
+                reader->failed = true;
+                break;
+            }
+            u64 consumed = newline ? length + 1 : length;
+            *line = string_view(begin, (u32)length);
+            reader->start += consumed;
+            reader->scanned = 0;
+            reader->line_offset = reader->offset;
+            reader->line_number++;
+            reader->offset += consumed;
+            return true;
+        }
+        if (reader->at_eof) {
+            break;
+        }
+
+        reader->scanned = available;
+        if (!fill_buffer(reader)) {
+            reader->failed = true;
+        }
+    }
+    return false;
 }
 
-bool is_readable_dir(const char* path)
+bool line_reader_next_lines(LineReader* reader, StringView* lines)
 {
-    struct stat file_stat;
-    bool is_dir = (stat(path, &file_stat) == 0 && S_ISDIR(file_stat.st_mode));
-    bool is_readable = access(path, F_OK) != -1;
-    return is_dir && is_readable;
+    while (!reader->failed) {
+        char* begin = reader->chars + reader->start;
+        u64 available = reader->end - reader->start;
+
+        // The lines end at the last newline (the first 'scanned' bytes are known not to have one)
+        u64 length = available;
+        while (length > reader->scanned && begin[length - 1] != '\n') {
+            length--;
+        }
+        if (length > reader->scanned || (reader->at_eof && available)) {
+            bool has_newline = length > reader->scanned;
+            length = has_newline ? length - 1 : available;
+            u64 consumed = has_newline ? length + 1 : length;
+            *lines = string_view(begin, (u32)length);
+            reader->start += consumed;
+            reader->scanned = 0;
+            reader->line_offset = reader->offset;
+            reader->offset += consumed;
+            return true;
+        }
+        if (reader->at_eof) {
+            break;
+        }
+
+        reader->scanned = available;
+        if (!fill_buffer(reader)) {
+            reader->failed = true;
+        }
+    }
+    return false;
+}
+
+void line_reader_close(LineReader* reader)
+{
+    if (reader->mapping) {
+        munmap(reader->mapping, reader->mapping_size);
+    } else {
+        free(reader->chars);
+    }
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+    *reader = {};
 }
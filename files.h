@@ -3,14 +3,63 @@
 #include "base.h"
 #include "string.h"
 
-/* Reads an entire file into memory and stores the result in a given StringBuffer.
+/* Reads a file line by line.
  *
- * Returns a String with the content if successful, 0 otherwise.
+ * Regular files of moderate size are memory mapped, and the lines are read straight from the
+ * mapping without copying them. Other files (small or very large files, pipes, character devices,
+ * etc.) are read in chunks through a buffer that only grows to fit the longest line, so the memory
+ * used stays bounded no matter how large the file is.
+ *
+ * The offsets are 64 bit, so files larger than 4 GiB can be read in full.
+ */
+struct LineReader {
+    int fd = -1;
+    // The mapping (for mapped files)
+    void* mapping = 0;
+    u64 mapping_size = 0;
+
+    // The data that has been read but not consumed is chars[start..end). For mapped files this is
+    // the rest of the file, otherwise it's the unconsumed part of the buffer.
+    char* chars = 0;
+    u64 start = 0;
+    u64 end = 0;
+    u64 capacity = 0;
+    // Number of bytes after 'start' that are known not to contain a newline
+    u64 scanned = 0;
+    bool at_eof = false;
+    bool failed = false;
+
+    // File offset and (1-based) line number of the last line returned
+    u64 line_offset = 0;
+    u64 line_number = 0;
+    // File offset of the next line
+    u64 offset = 0;
+};
+
+/* Opens the file for reading line by line.
+ *
+ * Returns true if successful, false otherwise. The reader must be closed with line_reader_close().
+ */
+bool line_reader_open(const char* filepath, LineReader* reader);
+
+/* Reads the next line, without the trailing newline. The line is only valid until the next call.
+ *
+ * Returns false at the end of the file, or if reading failed (in which case 'failed' is set).
+ * Lines longer than LINE_READER_MAX_LINE_LENGTH can't be read, and fail the reader.
+ */
+bool line_reader_next(LineReader* reader, StringView* line);
+
+/* Reads all the whole lines that are available, at least one. For mapped files this is the rest of
+ * the file, otherwise it's the lines in the buffer. The lines are separated by newlines, and the
+ * trailing newline of the last one is left out. They're only valid until the next call.
+ *
+ * Meant for scanning through a file faster than line by line. The line number isn't updated.
+ * Returns false at the end of the file, or if reading failed (in which case 'failed' is set).
  */
-String read_entire_file(const char* filepath);
+bool line_reader_next_lines(LineReader* reader, StringView* lines);
 
-/* Returns true if the given path is a readable, regular file. Symlinks are resolved. */
-bool is_readable_regfile(const char* filepath);
+/* Unmaps or frees the content, and closes the file. */
+void line_reader_close(LineReader* reader);
 
-/* Returns true if the given path is a readable directory. Symlinks are resolved. */
-bool is_readable_dir(const char* filepath);
+// The longest line that can be read
+#define LINE_READER_MAX_LINE_LENGTH (256 * 1024 * 1024)
@@ -14,6 +14,7 @@ qs [options] --template <template string> [<action arguments>, ...]
 
 Options:
   --actions:  List all available actions and exit.
+  --check:    Parse all config files in full, report any errors and exit.
   --dry-run:  Print the command that would have run, don't actually run it.
   --verbose:  Print more information while executing.
   --template: Ignore the preconfigured templates and use an explicit template instead.
@@ -36,6 +37,10 @@ Actions:
     - `$XDG_CONFIG_HOMEqs/default.cfg`
     - `$HOME.configs/qs/default.cfg` (unless XDG_CONFIG_HOME is set)
 
+  Each of the config files can be followed by a directory of config fragments (`*.cfg` files):
+  `.qs.d/` next to the `.qs.cfg` files, and `qs/conf.d/` next to `default.cfg`. A fragment takes
+  priority over the fragments whose names sort before it (e.g. `90-local.cfg` over `10-base.cfg`).
+
   Additional configuration files can be provided using --config, and will have a higher priority
   than the default ones in case the same action name ocurrs multiple times.
 
@@ -63,9 +68,19 @@ Configration files:
   Template strings or argument values is anything (except the leading whitespace) following
   the = or := to the end of the line.
 
+  Other config files can be included using `include <path>` (relative to the including file).
+  The included actions have the priority of the including file, but are shadowed by the ones it
+  declares itself, and they run from its directory. The variables of the including file take
+  precedence over the ones of the included file. Each file is only loaded once.
+
   Valid action-, or argument names follow the format [a-z][a-zA-Z0-9_-]+
   (e.g.  'fooBar', 'thing1', 'my_arg', 'my-arg-1').
 
+  Parsed configuration files are cached in `$XDG_CACHE_HOME/qs` (or `$HOME/.cache/qs`), and
+  are only parsed again once they change. Config files that can't be cached (e.g. pipes) and
+  very large ones are only scanned for the action, and the rest of them isn't validated. Use
+  --check to validate them.
+
 Templates:
   Templates can expand positional arguments using ${0}, ${1}, (etc) placeholders.
   Named arguments can be expanded using ${foobar}
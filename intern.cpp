@@ -0,0 +1,181 @@
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "arena.h"
+#include "intern.h"
+
+struct InternedName {
+    u32 hash;
+    StringView view;
+};
+
+// The names are stored in blocks that never move once allocated, block b holding
+// (INTERN_FIRST_BLOCK_SIZE << b) names. This way a name can be read without holding the lock.
+#define INTERN_FIRST_BLOCK_SIZE 64
+#define INTERN_MAX_BLOCKS 24
+
+/** An open addressing hash table of handles (0 marks an empty slot). */
+struct NameTable {
+    u32 capacity;
+    NameId* slots;
+};
+
+/**
+ * The interned names are stored in a dense (block) array indexed by (handle - 1), and found
+ * through the hash table of handles. The characters are allocated from an arena, since names are
+ * never released one by one. So are the hash tables, since a table that has been outgrown can
+ * still be read by another thread.
+ */
+struct InternTable {
+    Arena arena;
+
+    u32 count;
+    u32 num_blocks;
+    InternedName* blocks[INTERN_MAX_BLOCKS];
+
+    NameTable* table;
+};
+
+static InternTable interned = {};
+
+// NOTE(christoffer) Config files can be parsed on several threads at once (see workers.h), so
+// adding names goes through this lock. Looking up names doesn't: a name and its table slot are
+// only written once, and published (with release semantics) after they've been written. A thread
+// that finds a name in an outgrown table still gets the right handle, and one that doesn't find
+// it there takes the lock and looks again.
+static pthread_mutex_t interned_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static InternedName*
+get_name(NameId id)
+{
+    u32 block_number = (id - 1) / INTERN_FIRST_BLOCK_SIZE + 1;
+    u32 block = 31 - (u32)__builtin_clz(block_number);
+    u32 block_start = INTERN_FIRST_BLOCK_SIZE * ((1u << block) - 1);
+    return interned.blocks[block] + (id - 1 - block_start);
+}
+
+/**
+ * Returns the slot for the name in the table. This is either the slot holding the handle of the
+ * name, or the empty slot where it would be inserted.
+ */
+static u32
+find_name_slot(const NameTable* table, StringView name, u32 hash)
+{
+    u32 mask = table->capacity - 1;
+    u32 slot = hash & mask;
+    NameId id;
+    while ((id = __atomic_load_n(table->slots + slot, __ATOMIC_ACQUIRE))) {
+        InternedName* existing = get_name(id);
+        if (existing->hash == hash && string_view_eq(existing->view, name)) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/** Returns the handle of the name in the current table, or 0 if it isn't in it. */
+static NameId
+find_name(StringView name, u32 hash)
+{
+    const NameTable* table = __atomic_load_n(&interned.table, __ATOMIC_ACQUIRE);
+    return table ? __atomic_load_n(table->slots + find_name_slot(table, name, hash), __ATOMIC_ACQUIRE) : 0;
+}
+
+/** Makes room for 'count' names. Must be called with the lock held. */
+static void
+reserve_names(u32 count)
+{
+    u32 capacity = INTERN_FIRST_BLOCK_SIZE * ((1u << interned.num_blocks) - 1);
+    if (count > capacity) {
+        assert(interned.num_blocks < INTERN_MAX_BLOCKS);
+        interned.blocks[interned.num_blocks] = ALLOC(InternedName, INTERN_FIRST_BLOCK_SIZE << interned.num_blocks);
+        assert(interned.blocks[interned.num_blocks]);
+        interned.num_blocks++;
+    }
+
+    // Keep the table at most half full
+    NameTable* table = interned.table;
+    if (!table || count * 2 > table->capacity) {
+        NameTable* grown = ARENA_ALLOC(&interned.arena, NameTable, 1);
+        grown->capacity = table ? table->capacity * 2 : 128;
+        grown->slots = ARENA_ALLOC(&interned.arena, NameId, grown->capacity);
+        for (u32 i = 0; i < interned.count; i++) {
+            InternedName* name = get_name(i + 1);
+            grown->slots[find_name_slot(grown, name->view, name->hash)] = i + 1;
+        }
+        __atomic_store_n(&interned.table, grown, __ATOMIC_RELEASE);
+    }
+}
+
+NameId
+intern(StringView name)
+{
+    u32 hash = string_view_hash(name);
+    NameId id = find_name(name, hash);
+    if (id) {
+        return id;
+    }
+
+    pthread_mutex_lock(&interned_lock);
+    reserve_names(interned.count + 1);
+
+    NameTable* table = interned.table;
+    u32 slot = find_name_slot(table, name, hash);
+    id = table->slots[slot];
+    if (!id) {
+        char* chars = ARENA_ALLOC(&interned.arena, char, name.length + 1);
+        memcpy(chars, name.chars, name.length);
+
+        id = interned.count + 1;
+        InternedName* entry = get_name(id);
+        entry->hash = hash;
+        entry->view = string_view(chars, name.length);
+        __atomic_store_n(&interned.count, id, __ATOMIC_RELEASE);
+        __atomic_store_n(table->slots + slot, id, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&interned_lock);
+    return id;
+}
+
+NameId
+intern(const char* name)
+{
+    return intern(string_view(name));
+}
+
+NameId
+intern_lookup(StringView name)
+{
+    return find_name(name, string_view_hash(name));
+}
+
+StringView
+intern_view(NameId id)
+{
+    assert(id && id <= intern_count());
+    return get_name(id)->view;
+}
+
+u32 intern_hash(NameId id)
+{
+    assert(id && id <= intern_count());
+    return get_name(id)->hash;
+}
+
+u32 intern_count()
+{
+    return __atomic_load_n(&interned.count, __ATOMIC_ACQUIRE);
+}
+
+void intern_reset()
+{
+    pthread_mutex_lock(&interned_lock);
+    arena_release(&interned.arena);
+    for (u32 i = 0; i < interned.num_blocks; i++) {
+        free(interned.blocks[i]);
+    }
+    interned = {};
+    pthread_mutex_unlock(&interned_lock);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "base.h"
+#include "string.h"
+
+/**
+ * Handle to an interned name (an action or variable name). Every distinct name is interned once,
+ * so two names are equal if and only if their handles are. The handles are dense, starting at 1,
+ * which means that they can be used to index arrays. 0 is never a valid handle.
+ *
+ * The names are interned in a single table shared by the config, CLI and template code, and
+ * stay valid until intern_reset() is called. The functions can be called from any thread.
+ */
+typedef u32 NameId;
+
+/** Returns the handle of the name, interning it if it hasn't been seen before. */
+NameId intern(StringView name);
+NameId intern(const char* name);
+
+/**
+ * Returns the handle of the name if it has been interned, or 0 otherwise. A name that has never
+ * been interned can't be a key in any table, so lookups can stop early.
+ */
+NameId intern_lookup(StringView name);
+
+/** Returns the (%nul terminated) name of the handle. */
+StringView intern_view(NameId id);
+
+/** Returns the hash of the name (the same as string_hash() would), computed when it was interned. */
+u32 intern_hash(NameId id);
+
+/** Returns the number of interned names. All handles are less than or equal to this. */
+u32 intern_count();
+
+/** Releases all interned names. Any handles from before the call are invalid after it. */
+void intern_reset();
@@ -6,6 +6,7 @@
 
 #include "base.h"
 #include "cli.h"
+#include "config_cache.h"
 #include "configs.h"
 #include "files.h"
 #include "help_text.h"
@@ -29,34 +30,23 @@ print_usage(const char* exec_name)
 }
 
 static void
-print_available_actions(StringList* config_filepaths)
+print_available_actions(ActionIndex* index)
 {
-    StringList* config_path_item = config_filepaths;
-    StringList* seen = 0;
+    // The actions of each config file are listed as soon as it has been loaded, so that its
+    // warnings and errors are printed right before them
     bool did_print_header = false;
-    while (config_path_item) {
-        String config_path = config_path_item->string;
-        StringList* action_names = 0;
-        if (config_get_action_names(config_path, &action_names)) {
-            if (!did_print_header) {
-                fprintf(stdout, "Available actions:\n");
-                did_print_header = true;
-            }
-            StringList* action_name_item = action_names;
-            while (action_name_item) {
-                String action_name = action_name_item->string;
-                bool shadowed = string_list_contains(seen, action_name);
-                if (!shadowed) {
-                    fprintf(stdout, " - %-35s (%s)\n", action_name, config_path);
-                    seen = string_list_add_front_dup(seen, action_name);
-                }
-                action_name_item = action_name_item->next;
-            }
-            string_list_free(action_names);
+    u32 num_listed = 0;
+    bool loaded = false;
+    while (action_index_load_next(index, &loaded)) {
+        if (loaded && !did_print_header) {
+            fprintf(stdout, "Available actions:\n");
+            did_print_header = true;
+        }
+        for (; num_listed < index->num_actions; num_listed++) {
+            IndexedAction* action = index->actions + num_listed;
+            fprintf(stdout, " - %-35s (%s)\n", action->action_name, index->config_paths[action->config_index]);
         }
-        config_path_item = config_path_item->next;
     }
-    string_list_free(seen);
 }
 
 /**
@@ -72,15 +62,18 @@ static void dirname(String filepath)
     if (!offset) {
         filepath[0] = '.';
         filepath[1] = '\0';
+        set_string_len(filepath, 1);
     } else {
         filepath[offset] = '\0';
+        set_string_len(filepath, offset);
     }
 }
 
 static void
 exec_with_options(CommandLineOptions options, String shell_command, char* cwd)
 {
-    String cmd = string_new("cd ");
+    SmallString cmd_storage;
+    String cmd = string_new(&cmd_storage, "cd ");
     cmd = string_append(cmd, cwd ? cwd : ".");
     cmd = string_append(cmd, "; QS_RUN_DIR=");
 
@@ -110,25 +103,68 @@ exec_with_options(CommandLineOptions options, String shell_command, char* cwd)
 static void
 populate_options_with_default_config_files(CommandLineOptions* options)
 {
-    StringList* default_config_files = resolve_default_config_files();
-
-    if (options->config_files) {
-        // Add the default configs files after the user provided ones
-        StringList* end = options->config_files;
-        while (end && end->next)
-            end = end->next;
-        end->next = default_config_files;
-    } else {
-        // Set the config files to just the default ones
-        options->config_files = default_config_files;
-    }
+    // Add the default configs files after the user provided ones
+    resolve_default_config_files(&options->arena, &options->config_files);
 
-    if (options->verbose && options->config_files) {
+    if (options->verbose && options->config_files.count) {
         fprintf(stdout, "Searching the following configuration files:\n");
-        StringList* node = options->config_files;
-        while (node) {
-            fprintf(stdout, " - %s\n", node->string);
-            node = node->next;
+        for (u32 i = 0; i < options->config_files.count; i++) {
+            fprintf(stdout, " - %s\n", options->config_files.items[i]);
+        }
+    }
+}
+
+/**
+ * Renders the compiled template. Variables are looked up in the scope, except for the positional
+ * ones, which are taken straight from the positional arguments given on the command line.
+ */
+static String
+render_template(CompiledTemplate* compiled, const VarScope* scope, CommandLineOptions* options)
+{
+    char** slot_values = ALLOC(char*, compiled->num_slots);
+    assert(slot_values);
+    template_bind(compiled, scope, slot_values);
+    for (u8 i = 0; i < options->num_positional_args; i++) {
+        slot_values[i] = options->positional_args[i];
+    }
+    String result = template_render(compiled, slot_values);
+    free(slot_values);
+    return result;
+}
+
+/**
+ * Prints the variables that the config files provide for the action. They're taken from the
+ * include chain of the config file that declared it, where an including config file's value takes
+ * precedence (see action_index_var_scope()).
+ */
+static void
+print_action_config_vars(const ActionIndex* index, const IndexedAction* action)
+{
+    bool printed_header = false;
+    for (u32 config_index = action->config_index;; config_index = index->config_parents[config_index]) {
+        const CompiledConfig* config = index->configs + config_index;
+        for (u32 i = 0; i < config->num_vars; i++) {
+            const CompiledConfigEntry* var = config->vars + i;
+            String name = compiled_config_string(config, var->name_offset);
+
+            // Skip the variables that are overridden by an including config file
+            bool overridden = false;
+            for (u32 outer = config_index; !overridden && index->config_parents[outer] != outer;) {
+                outer = index->config_parents[outer];
+                overridden = compiled_config_get_var(index->configs + outer, intern(name)) != 0;
+            }
+            if (overridden) {
+                continue;
+            }
+
+            if (!printed_header) {
+                fprintf(stdout, "with predefined variable values:\n");
+                printed_header = true;
+            }
+            fprintf(stdout, " - ${%s} => %s\n", name, compiled_config_string(config, var->value_offset));
+        }
+        if (index->config_parents[config_index] == config_index) {
+            break;
         }
     }
 }
@@ -162,10 +198,25 @@ process_options(CommandLineOptions* options, const char* program_name)
 
     if (options->print_available_actions) {
         populate_options_with_default_config_files(options);
-        print_available_actions(options->config_files);
+        ActionIndex index = {};
+        action_index_init(&index, &options->config_files, &options->arena);
+        print_available_actions(&index);
+        action_index_free(&index);
         return ErrorType_None;
     }
 
+    if (options->check_configs) {
+        populate_options_with_default_config_files(options);
+        ActionIndex index = {};
+        action_index_init(&index, &options->config_files, &options->arena);
+        bool valid = action_index_check(&index);
+        if (valid) {
+            fprintf(stdout, "Checked config files: %u\n", index.num_configs);
+        }
+        action_index_free(&index);
+        return valid ? ErrorType_None : ErrorType_Error;
+    }
+
     if (options->action_name && options->action_template) {
         fprintf(stdout, "Error: Must provide either an action name or a template string (--template), not both.\n");
         return ErrorType_User;
@@ -181,10 +232,14 @@ process_options(CommandLineOptions* options, const char* program_name)
         if (options->verbose) {
             fprintf(stdout, "Resolved template: %s\n", options->action_template);
         }
-        String command = template_render(options->action_template, options->variables);
-        if (command) {
+        CompiledTemplate compiled = {};
+        if (template_compile(options->action_template, &compiled)) {
+            VarScope cli_scope = {};
+            cli_scope.vars = &options->variables;
+            String command = render_template(&compiled, &cli_scope, options);
             exec_with_options(*options, command, 0);
             string_free(command);
+            template_compiled_free(&compiled);
             return ErrorType_None;
         }
         return ErrorType_User;
@@ -194,81 +249,63 @@ process_options(CommandLineOptions* options, const char* program_name)
         // User gave an action name. Dig into the config files and try to resolve it.
         populate_options_with_default_config_files(options);
 
-        // Search through the configuration files for an action with the given name in order to find
-        // the template.
+        // Look up the action in the configuration files. The first declaration of the action (in
+        // priority order) is the one that's used.
         char* action_name = options->action_name;
-        char* config_path = 0;
-
-        // Loop through the configuration files and look for the first declaration of the
-        // sought action.
-        ResolvedTemplateResult template_res;
-        StringList* config_file = options->config_files;
-        while (config_file) {
-            config_path = config_file->string;
-            template_res = resolve_template_for_action(config_path, action_name);
-            if (template_res.parse_error) {
-                return ErrorType_Error;
-            } else if (template_res.action_template) {
-                // Found the action template, stop looking
-                break;
-            }
-            config_file = config_file->next;
-        }
+        ActionIndex index = {};
+        action_index_init(&index, &options->config_files, &options->arena);
+
+        bool parse_error = false;
+        const IndexedAction* action = action_index_find(&index, action_name, &parse_error);
 
-        if (template_res.action_template) {
+        ErrorType error;
+        if (parse_error) {
+            error = ErrorType_Error;
+        } else if (action) {
             // Successfully resolved a valid template for the action
+            String config_path = index.config_paths[action->config_index];
             if (options->verbose) {
-                fprintf(stdout, "Resolved template: %s\nFrom: %s\n", template_res.action_template, config_path ? config_path : "--template");
-                if (template_res.vars) {
-                    fprintf(stdout, "with predefined variable values:\n");
-                    VarList* vars = template_res.vars;
-                    while (vars) {
-                        fprintf(stdout, " - ${%s} => %s\n", vars->name, vars->value);
-                        vars = vars->next;
-                    }
-                }
+                fprintf(stdout, "Resolved template: %s\nFrom: %s\n", action->action_template, config_path);
+                print_action_config_vars(&index, action);
             }
 
-            ErrorType error;
-            if (options->print_action_help) {
-                String usage = template_generate_usage(template_res.action_template, options->action_name);
-                if (usage) {
-                    fprintf(stdout, "%s", usage);
-                    string_free(usage);
-                    error = ErrorType_None;
-                } else {
-                    fprintf(stderr, "Invalid action template: %s\n", template_res.action_template);
-                    error = ErrorType_Error;
-                }
+            CompiledTemplate compiled = {};
+            if (!template_compile(action->action_template, &compiled)) {
+                fprintf(stderr, "Invalid action template: %s\n", action->action_template);
+                error = ErrorType_Error;
+            } else if (options->print_action_help) {
+                String usage = template_generate_usage(&compiled, options->action_name);
+                fprintf(stdout, "%s", usage);
+                string_free(usage);
+                error = ErrorType_None;
             } else {
-                // Set the config path for the template render function to use when setting the
-                // command QS_RUN_DIR varibable
-                if (config_path)
-                    dirname(config_path);
-
-                // Merge the user defined variables into the config file provided variables
-                VarList* merged_vars = template_merge(template_res.vars, options->variables);
-                String command = template_render(template_res.action_template, merged_vars);
-                template_free(merged_vars);
-                if (command) {
-                    exec_with_options(*options, command, config_path);
-                    string_free(command);
-                    error = ErrorType_None;
-                } else {
-                    fprintf(stderr, "Invalid action template: %s\n", template_res.action_template);
-                    error = ErrorType_Error;
-                }
+                // Run the command from the directory of the config file that declared the action (or
+                // the one in the search list that included it)
+                SmallString config_dir_storage;
+                String config_dir = string_new(&config_dir_storage, index.config_paths[action->root_config_index]);
+                dirname(config_dir);
+
+                // The user defined variables take precedence over the config file provided ones
+                VarScope config_scope = {};
+                action_index_var_scope(&index, action, &config_scope);
+                VarScope cli_scope = {};
+                cli_scope.vars = &options->variables;
+                cli_scope.parent = &config_scope;
+                String command = render_template(&compiled, &cli_scope, options);
+                exec_with_options(*options, command, config_dir);
+                string_free(command);
+                string_free(config_dir);
+                error = ErrorType_None;
             }
-
-            // Free the template result resources
-            string_free(template_res.action_template);
-            template_free(template_res.vars);
-            return error;
+            template_compiled_free(&compiled);
         } else {
             // Failed to find an template for the action
             fprintf(stdout, "Could not find action with name: %s\n", action_name);
-            return ErrorType_User;
+            error = ErrorType_User;
         }
+
+        action_index_free(&index);
+        return error;
     }
 
     assert(false); // All possible combinations should have been exhausted at this point
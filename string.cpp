@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <string.h>
 
 #include "string.h"
 
@@ -6,13 +7,22 @@
 #define HEADER_SIZE 8
 #define NUL_SIZE 1
 
-// How many bytes to overgrow the buffer with when it needs to expand.
-// The current value choosen completely arbitrarily.
+// The least number of bytes to overgrow the buffer with when it needs to expand. Larger buffers
+// grow geometrically (see string_ensure_fits_len).
 #define BUFFER_OVERGROW 64
 
+// The highest bit of the buffer size is set for strings whose buffer isn't owned by the string
+// itself, but by an arena or a SmallString.
+#define BORROWED_BUFFER_FLAG 0x80000000u
+
 // NOTE(christoffer) See note about casting to void * in string.h
 #define _get_bufsize(str) (*((u32*)((void*)(str - HEADER_SIZE))))
 #define _set_bufsize(str, bufsize) (*((u32*)(void*)((str - HEADER_SIZE))) = bufsize)
+// The number of characters that fit in the buffer (excluding the %nul)
+#define _get_capacity(str) ((_get_bufsize(str) & ~BORROWED_BUFFER_FLAG) - HEADER_SIZE - NUL_SIZE)
+
+// The largest capacity a string can have, since the top bit of the buffer size is reserved
+#define MAX_CAPACITY (BORROWED_BUFFER_FLAG - 1 - HEADER_SIZE - NUL_SIZE)
 
 /**
  * A String implementation where the buffer size and the string length are prepended to the
@@ -23,31 +33,11 @@
  *
  * [ buffer_size (4 bytes) ][ string length (4 bytes) ][ content (buffer_size bytes)
  *                                                     ^  pointer returned to caller
+ *
+ * Strings allocated from an arena, or stored in a SmallString, have the BORROWED_BUFFER_FLAG set in
+ * their buffer size. Freeing them is a noop until they outgrow the buffer and move to the heap.
  */
 
-u32 cstrlen(const char* cstr)
-{
-    u32 nul_offset = 0;
-    while (*(cstr + nul_offset++))
-        ;
-    return nul_offset - 1;
-}
-
-void cstrcpy(char* dest, const char* src)
-{
-    while ((*(dest++) = *(src++)))
-        ;
-}
-
-void cstrcat(char* dest, const char* src)
-{
-    while (*(dest++))
-        ; // seek to %nul
-    dest--; // backtrack to overwrite the %nul
-    while ((*(dest++) = *(src++)))
-        ; // copy until (including) src %nul
-}
-
 String
 string_new()
 {
@@ -77,6 +67,49 @@ string_new(const char* content)
     return string;
 }
 
+String
+string_new(Arena* arena, const char* content)
+{
+    u32 content_len = cstrlen(content);
+    u32 req_bufsize = HEADER_SIZE + content_len + NUL_SIZE;
+    char* buf = ARENA_ALLOC(arena, char, req_bufsize);
+
+    String string = (String)(buf + HEADER_SIZE);
+    cstrcpy(string, content);
+
+    _set_bufsize(string, req_bufsize | BORROWED_BUFFER_FLAG);
+    set_string_len(string, content_len);
+    return string;
+}
+
+String
+string_new(SmallString* storage, const char* content)
+{
+    u32 content_len = cstrlen(content);
+    if (content_len > SMALL_STRING_CAPACITY) {
+        return string_new(content);
+    }
+
+    String string = storage->content;
+    memcpy(string, content, content_len + NUL_SIZE);
+    _set_bufsize(string, (u32)sizeof(SmallString) | BORROWED_BUFFER_FLAG);
+    set_string_len(string, content_len);
+    return string;
+}
+
+String
+string_new(Arena* arena, StringView view)
+{
+    char* buf = ARENA_ALLOC(arena, char, HEADER_SIZE + view.length + NUL_SIZE);
+    String string = (String)(buf + HEADER_SIZE);
+    memcpy(string, view.chars, view.length);
+    string[view.length] = '\0';
+
+    _set_bufsize(string, (HEADER_SIZE + view.length + NUL_SIZE) | BORROWED_BUFFER_FLAG);
+    set_string_len(string, view.length);
+    return string;
+}
+
 void string_clear(String string)
 {
     set_string_len(string, 0);
@@ -85,7 +118,7 @@ void string_clear(String string)
 
 void string_free(String string)
 {
-    if (string) {
+    if (string && !(_get_bufsize(string) & BORROWED_BUFFER_FLAG)) {
         char* bufptr = ((char*)string) - HEADER_SIZE;
         free(bufptr);
     }
@@ -102,9 +135,21 @@ string_resizebuf(String string, u32 new_bufsize)
         return string;
     }
 
-    // Resize buffer and write the new buffer size
-    bufptr = (char*)realloc(bufptr, new_bufsize);
-    assert(bufptr);
+    if (cur_bufsize & BORROWED_BUFFER_FLAG) {
+        // Borrowed buffers can't be resized, so move the string to the heap instead
+        cur_bufsize &= ~BORROWED_BUFFER_FLAG;
+        char* heap_bufptr = ALLOC(char, new_bufsize);
+        assert(heap_bufptr);
+        u32 copy_size = cur_bufsize < new_bufsize ? cur_bufsize : new_bufsize;
+        for (u32 i = 0; i < copy_size; i++) {
+            heap_bufptr[i] = bufptr[i];
+        }
+        bufptr = heap_bufptr;
+    } else {
+        // Resize buffer and write the new buffer size
+        bufptr = (char*)realloc(bufptr, new_bufsize);
+        assert(bufptr);
+    }
     string = bufptr + HEADER_SIZE;
     _set_bufsize(string, new_bufsize);
 
@@ -118,36 +163,62 @@ string_resizebuf(String string, u32 new_bufsize)
     return string;
 }
 
+String
+string_reserve(String string, u32 capacity)
+{
+    assert(capacity <= MAX_CAPACITY);
+    if (_get_capacity(string) < capacity) {
+        string = string_resizebuf(string, capacity + HEADER_SIZE + NUL_SIZE);
+    }
+    return string;
+}
+
 String
 string_ensure_fits_len(String string, u32 at_least_length)
 {
-    u32 curlen = string_len(string);
-    if (curlen < at_least_length) {
-        u32 req_bufsize = at_least_length + HEADER_SIZE + NUL_SIZE;
-        string = string_resizebuf(string, req_bufsize + BUFFER_OVERGROW);
+    assert(at_least_length <= MAX_CAPACITY);
+    u32 capacity = _get_capacity(string);
+    if (capacity < at_least_length) {
+        // NOTE(christoffer) Grow the buffer geometrically. Growing by a fixed amount makes a
+        // sequence of appends quadratic, since each resize might copy the whole string.
+        u64 new_capacity = (u64)capacity * 2;
+        if (new_capacity < (u64)at_least_length + BUFFER_OVERGROW) {
+            new_capacity = (u64)at_least_length + BUFFER_OVERGROW;
+        }
+        if (new_capacity > MAX_CAPACITY) {
+            new_capacity = MAX_CAPACITY;
+        }
+        string = string_resizebuf(string, (u32)new_capacity + HEADER_SIZE + NUL_SIZE);
     }
     return string;
 }
 
 String
 string_append(String string, const char* content)
+{
+    return string_append(string, content, cstrlen(content));
+}
+String
+string_append(String string, const char chr)
 {
     u32 cur_len = string_len(string);
-    u32 new_len = cur_len + cstrlen(content);
+    u32 new_len = cur_len + 1;
     string = string_ensure_fits_len(string, new_len);
-    cstrcat(string, content);
-    *(string + new_len) = '\0';
+
+    string[cur_len] = chr;
+    string[new_len] = '\0';
     set_string_len(string, new_len);
     return string;
 }
+
 String
-string_append(String string, const char chr)
+string_append(String string, const char* content, u32 count)
 {
     u32 cur_len = string_len(string);
-    u32 new_len = cur_len + 1;
+    u32 new_len = cur_len + count;
     string = string_ensure_fits_len(string, new_len);
 
-    string[cur_len] = chr;
+    memcpy(string + cur_len, content, count);
     string[new_len] = '\0';
     set_string_len(string, new_len);
     return string;
@@ -156,8 +227,13 @@ string_append(String string, const char chr)
 String
 string_copy(String string, const char* content, u32 count)
 {
-    u32 content_len = cstrlen(content);
-    u32 new_len = content_len < count ? content_len : count;
+    // NOTE(christoffer) Only scan up to 'count' bytes for the %nul. The content is often a
+    // substring of a much larger buffer (e.g. a line in a config file), and measuring the
+    // whole remainder of that buffer makes callers that copy piece by piece quadratic.
+    u32 new_len = 0;
+    while (new_len < count && content[new_len]) {
+        new_len++;
+    }
     string = string_ensure_fits_len(string, new_len);
 
     u32 copied_len = 0;
@@ -180,42 +256,196 @@ string_copy(String string, const char* content)
     return result;
 }
 
-StringList*
-string_list_add_front_dup(StringList* list, const char* content)
+void string_array_push(Arena* arena, StringArray* array, const char* content)
 {
-    StringList* node = ALLOC(StringList, 1);
-    node->string = string_new(content);
-    node->next = list;
-    return node;
+    if (array->count == array->capacity) {
+        // NOTE(christoffer) The arena can't grow an allocation in place, so the items are moved
+        // to a new allocation twice the size. The old one is released together with the arena.
+        u32 capacity = array->capacity ? array->capacity * 2 : 8;
+        String* items = ARENA_ALLOC(arena, String, capacity);
+        if (array->count) {
+            memcpy(items, array->items, array->count * sizeof(String));
+        }
+        array->items = items;
+        array->capacity = capacity;
+    }
+    array->items[array->count++] = string_new(arena, content);
+}
+
+void string_array_reverse(StringArray* array)
+{
+    for (u32 i = 0; i < array->count / 2; i++) {
+        String tmp = array->items[i];
+        array->items[i] = array->items[array->count - 1 - i];
+        array->items[array->count - 1 - i] = tmp;
+    }
 }
 
-bool string_list_contains(StringList* list, const char* value)
+bool string_array_contains(StringArray* array, const char* value)
 {
-    while (list) {
-        if (string_eq(list->string, value)) {
+    for (u32 i = 0; i < array->count; i++) {
+        if (string_eq(array->items[i], value)) {
             return true;
         }
-        list = list->next;
     }
     return false;
 }
 
-void string_list_free(StringList* list)
+// 32-bit FNV-1a
+#define HASH_OFFSET_BASIS 2166136261u
+#define HASH_PRIME 16777619u
+
+u32 string_hash(const char* string)
 {
-    while (list) {
-        StringList* dead = list;
-        list = list->next;
-        string_free(dead->string);
-        free(dead);
+    u32 hash = HASH_OFFSET_BASIS;
+    while (*string) {
+        hash ^= (u8)*(string++);
+        hash *= HASH_PRIME;
     }
+    return hash;
 }
 
-bool string_eq(const char* a, const char* b)
+u32 string_hash(const char* content, u32 count)
 {
-    // Break immidiately if we didn't get strings, or if the first char doesn't match
-    if ((!a || !b) || (*a != *b)) {
-        return false;
+    u32 hash = HASH_OFFSET_BASIS;
+    for (u32 i = 0; i < count; i++) {
+        hash ^= (u8)content[i];
+        hash *= HASH_PRIME;
+    }
+    return hash;
+}
+
+StringView
+string_view(const char* cstr)
+{
+    StringView view = {};
+    view.chars = cstr;
+    view.length = cstrlen(cstr);
+    return view;
+}
+
+StringView
+string_view(const char* chars, u32 length)
+{
+    StringView view = {};
+    view.chars = chars;
+    view.length = length;
+    return view;
+}
+
+bool string_view_eq(StringView a, StringView b)
+{
+    return a.length == b.length && !memcmp(a.chars, b.chars, a.length);
+}
+
+bool string_view_eq(StringView a, const char* b)
+{
+    // Compare up to the length of the view, and make sure 'b' ends there as well
+    u32 i = 0;
+    while (i < a.length && b[i] && a.chars[i] == b[i]) {
+        i++;
+    }
+    return i == a.length && !b[i];
+}
+
+bool string_view_starts_with(StringView view, StringView prefix)
+{
+    return prefix.length && prefix.length <= view.length && !memcmp(view.chars, prefix.chars, prefix.length);
+}
+
+u32 string_view_hash(StringView view)
+{
+    return string_hash(view.chars, view.length);
+}
+
+#define _is_inline(inline_string) ((inline_string)->length < INLINE_STRING_CAPACITY)
+
+void inline_string_set(InlineString* string, const char* content, u32 count)
+{
+    // NOTE(christoffer) The content is allowed to point into the string itself, so the previous
+    // buffer is only released once the content has been copied.
+    char* previous_heap_chars = _is_inline(string) ? 0 : string->heap_chars;
+
+    char* dest;
+    if (count < INLINE_STRING_CAPACITY) {
+        dest = string->inline_chars;
+        for (u32 i = 0; i < count; i++) {
+            dest[i] = content[i];
+        }
+    } else {
+        dest = ALLOC(char, count + NUL_SIZE);
+        assert(dest);
+        for (u32 i = 0; i < count; i++) {
+            dest[i] = content[i];
+        }
+        string->heap_chars = dest;
+    }
+    dest[count] = '\0';
+    string->length = count;
+
+    free(previous_heap_chars);
+}
+
+char* inline_string_chars(InlineString* string)
+{
+    return _is_inline(string) ? string->inline_chars : string->heap_chars;
+}
+
+StringView
+inline_string_view(InlineString* string)
+{
+    return string_view(inline_string_chars(string), string->length);
+}
+
+void inline_string_free(InlineString* string)
+{
+    if (!_is_inline(string)) {
+        free(string->heap_chars);
     }
+    *string = {};
+}
+
+/**
+ * The string primitives below are on every hot path (parsing, lookups and rendering), so on x86
+ * they're implemented with SSE2 and AVX2 as well. The implementation is selected at runtime
+ * based on what the CPU supports, with the scalar one as the fallback.
+ *
+ * NOTE(christoffer) The vectorized versions read whole blocks of 16 or 32 bytes, which might
+ * extend past the %nul of the string. This is only safe as long as the read doesn't cross into
+ * the next page (which might not be mapped). Aligned loads never do, and unaligned ones are only
+ * made when they don't cross a page boundary. The reads are still outside of the string as far
+ * as the address sanitizer is concerned, so it's disabled for these functions.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define STRING_SIMD_X86 1
+#include <immintrin.h>
+
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+
+// The smallest page size of the supported platforms. Larger pages are multiples of it, so
+// their boundaries are also boundaries of this size.
+#define MIN_PAGE_SIZE 4096
+
+#define _crosses_page(ptr, size) ((((uintptr_t)(ptr)) & (MIN_PAGE_SIZE - 1)) > (MIN_PAGE_SIZE - (size)))
+#endif
+
+// The level in use (or -1 until it's been detected). Only accessed atomically, since the strings
+// are used from worker threads too (see workers.h), and the first use can be on any of them.
+static int selected_simd_level = -1;
+
+static u32
+cstrlen_scalar(const char* cstr)
+{
+    u32 nul_offset = 0;
+    while (*(cstr + nul_offset++))
+        ;
+    return nul_offset - 1;
+}
+
+static bool
+string_eq_scalar(const char* a, const char* b)
+{
     // Loop while both of the strings are equal, and both of them have a value.
     while ((*a && *b) && (*a == *b)) {
         a++;
@@ -225,16 +455,206 @@ bool string_eq(const char* a, const char* b)
     return !(*a || *b);
 }
 
-bool string_starts_with(const char* string, const char* substring)
+static bool
+string_starts_with_scalar(const char* string, const char* substring)
 {
-    if (!string || !substring) {
-        return false;
+    while (*substring && (*string == *substring)) {
+        string++;
+        substring++;
+    }
+    return !*substring;
+}
+
+#ifdef STRING_SIMD_X86
+
+NO_SANITIZE_ADDRESS static u32
+cstrlen_sse2(const char* cstr)
+{
+    // Start at the aligned block containing the first character, and ignore the matches for
+    // the bytes before it.
+    u32 misalignment = (u32)((uintptr_t)cstr & 15);
+    const char* block = cstr - misalignment;
+    __m128i zero = _mm_setzero_si128();
+    u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)(const void*)block), zero)) >> misalignment;
+    if (mask) {
+        return (u32)__builtin_ctz(mask);
     }
+    while (true) {
+        block += 16;
+        mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)(const void*)block), zero));
+        if (mask) {
+            return (u32)(block - cstr) + (u32)__builtin_ctz(mask);
+        }
+    }
+}
 
-    do {
-        if (*string != *substring) {
-            return false;
+__attribute__((target("avx2"))) NO_SANITIZE_ADDRESS static u32
+cstrlen_avx2(const char* cstr)
+{
+    u32 misalignment = (u32)((uintptr_t)cstr & 31);
+    const char* block = cstr - misalignment;
+    __m256i zero = _mm256_setzero_si256();
+    u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*)(const void*)block), zero)) >> misalignment;
+    if (mask) {
+        return (u32)__builtin_ctz(mask);
+    }
+    while (true) {
+        block += 32;
+        mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*)(const void*)block), zero));
+        if (mask) {
+            return (u32)(block - cstr) + (u32)__builtin_ctz(mask);
         }
-    } while (*(++substring) && *(++string));
-    return true;
+    }
+}
+
+/**
+ * Returns the offset of the first position where the strings differ, or where 'a' has a %nul.
+ * Compares 16 bytes at a time, stepping byte by byte past page boundaries.
+ */
+NO_SANITIZE_ADDRESS static u32
+find_stop_offset_sse2(const char* a, const char* b)
+{
+    u32 offset = 0;
+    while (true) {
+        if (_crosses_page(a + offset, 16) || _crosses_page(b + offset, 16)) {
+            if (a[offset] != b[offset] || !a[offset]) {
+                return offset;
+            }
+            offset++;
+        } else {
+            __m128i va = _mm_loadu_si128((const __m128i*)(const void*)(a + offset));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(const void*)(b + offset));
+            u32 equal = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+            u32 nul = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(va, _mm_setzero_si128()));
+            u32 stop = (~equal & 0xFFFF) | nul;
+            if (stop) {
+                return offset + (u32)__builtin_ctz(stop);
+            }
+            offset += 16;
+        }
+    }
+}
+
+__attribute__((target("avx2"))) NO_SANITIZE_ADDRESS static u32
+find_stop_offset_avx2(const char* a, const char* b)
+{
+    u32 offset = 0;
+    while (true) {
+        if (_crosses_page(a + offset, 32) || _crosses_page(b + offset, 32)) {
+            if (a[offset] != b[offset] || !a[offset]) {
+                return offset;
+            }
+            offset++;
+        } else {
+            __m256i va = _mm256_loadu_si256((const __m256i*)(const void*)(a + offset));
+            __m256i vb = _mm256_loadu_si256((const __m256i*)(const void*)(b + offset));
+            u32 equal = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+            u32 nul = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, _mm256_setzero_si256()));
+            u32 stop = ~equal | nul;
+            if (stop) {
+                return offset + (u32)__builtin_ctz(stop);
+            }
+            offset += 32;
+        }
+    }
+}
+
+static StringSimdLevel
+simd_level()
+{
+    int level = __atomic_load_n(&selected_simd_level, __ATOMIC_RELAXED);
+    if (level < 0) {
+        // Detecting the level gives the same result on every thread, so it doesn't matter which
+        // one stores it
+        level = string_detect_simd_level();
+        __atomic_store_n(&selected_simd_level, level, __ATOMIC_RELAXED);
+    }
+    return (StringSimdLevel)level;
+}
+
+#endif // STRING_SIMD_X86
+
+StringSimdLevel
+string_detect_simd_level()
+{
+#ifdef STRING_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return StringSimdLevel_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return StringSimdLevel_SSE2;
+    }
+#endif
+    return StringSimdLevel_Scalar;
+}
+
+void string_set_simd_level(StringSimdLevel level)
+{
+    StringSimdLevel supported = string_detect_simd_level();
+    __atomic_store_n(&selected_simd_level, (int)(level < supported ? level : supported), __ATOMIC_RELAXED);
+}
+
+u32 cstrlen(const char* cstr)
+{
+#ifdef STRING_SIMD_X86
+    StringSimdLevel level = simd_level();
+    if (level == StringSimdLevel_AVX2) {
+        return cstrlen_avx2(cstr);
+    } else if (level == StringSimdLevel_SSE2) {
+        return cstrlen_sse2(cstr);
+    }
+#endif
+    return cstrlen_scalar(cstr);
+}
+
+void cstrcpy(char* dest, const char* src)
+{
+    // Both the length and the copy are vectorized, which beats copying byte by byte even
+    // though the source is read twice.
+    memcpy(dest, src, cstrlen(src) + NUL_SIZE);
+}
+
+void cstrcat(char* dest, const char* src)
+{
+    cstrcpy(dest + cstrlen(dest), src);
+}
+
+bool string_eq(const char* a, const char* b)
+{
+    // Break immidiately if we didn't get strings, or if the first char doesn't match
+    if ((!a || !b) || (*a != *b)) {
+        return false;
+    }
+#ifdef STRING_SIMD_X86
+    // The stop offset is either at the first difference, or at the end of 'a'. The strings are
+    // only equal in the latter case.
+    StringSimdLevel level = simd_level();
+    if (level == StringSimdLevel_AVX2) {
+        u32 offset = find_stop_offset_avx2(a, b);
+        return a[offset] == b[offset];
+    } else if (level == StringSimdLevel_SSE2) {
+        u32 offset = find_stop_offset_sse2(a, b);
+        return a[offset] == b[offset];
+    }
+#endif
+    return string_eq_scalar(a, b);
+}
+
+bool string_starts_with(const char* string, const char* substring)
+{
+    // Nothing starts with the empty string
+    if (!string || !substring || !*substring) {
+        return false;
+    }
+#ifdef STRING_SIMD_X86
+    // Stop at the end of the substring (rather than the string) by passing it first
+    StringSimdLevel level = simd_level();
+    if (level == StringSimdLevel_AVX2) {
+        return !substring[find_stop_offset_avx2(substring, string)];
+    } else if (level == StringSimdLevel_SSE2) {
+        return !substring[find_stop_offset_sse2(substring, string)];
+    }
+#endif
+    return string_starts_with_scalar(string, substring);
 }
@@ -1,14 +1,11 @@
 #pragma once
 
+#include "arena.h"
 #include "base.h"
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunused-macros"
 
-#define is_alpha(c) ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
-#define is_digit(c) (c >= '0' && c <= '9')
-#define is_identifier_char(c) (is_alpha(c) || is_digit(c) || c == '-' || c == '_')
-
 // NOTE(christoffer) Cast to void * to avoid the alignment warning from clang.
 // It seems like the x86 architecture doesn't have an aligment requirement on int (vs char)
 // which the warning is warning about, so I think we're fine until we actually want to support
@@ -20,30 +17,136 @@
 
 typedef char* String;
 
-struct StringList {
-    String string = 0;
-    StringList* next = 0;
+/**
+ * A growable array of strings, allocated from an arena. A zero initialized StringArray is empty.
+ * The strings are stored contiguously, so iterating over them doesn't chase pointers.
+ */
+struct StringArray {
+    u32 count = 0;
+    u32 capacity = 0;
+    String* items = 0;
+};
+
+/**
+ * A non-owning view of a string: a pointer to the first character and a length. The characters
+ * aren't %nul terminated, so views can refer to parts of a larger buffer (e.g. a line in a config
+ * file, or a single command line argument) without copying them. The viewed characters must
+ * outlive the view.
+ */
+struct StringView {
+    const char* chars = 0;
+    u32 length = 0;
+};
+
+// Strings up to this length (excluding the %nul) fit in a SmallString
+#define SMALL_STRING_CAPACITY 119
+
+/**
+ * Storage for a short String, laid out just like a heap allocated one. Meant to be placed on the
+ * stack (or inside another structure) to avoid allocating the many short lived strings such as
+ * paths and names. Strings that don't fit, or that outgrow it later, are moved to the heap.
+ */
+struct SmallString {
+    u32 bufsize;
+    u32 length;
+    char content[SMALL_STRING_CAPACITY + 1];
+};
+
+// Strings shorter than this (excluding the %nul) are stored inline in an InlineString
+#define INLINE_STRING_CAPACITY 24
+
+/**
+ * A string that stores short content inline, and only allocates a buffer for longer content.
+ * Meant to be embedded in other structures (e.g. hash table entries). A zero initialized
+ * InlineString is the empty string.
+ */
+struct InlineString {
+    union {
+        char inline_chars[INLINE_STRING_CAPACITY];
+        char* heap_chars;
+    };
+    u32 length;
 };
 
 String string_new();
 String string_new(const char* content);
+/**
+ * Allocates the string from the arena. Freeing an arena string is a no-op; it lives until the
+ * arena is reset or released. Growing it moves the string to the heap, after which it has to be
+ * freed with string_free() like any other string.
+ */
+String string_new(Arena* arena, const char* content);
+/**
+ * Stores the string in 'storage' if it fits, and on the heap otherwise. Always free the string
+ * with string_free() since it might have moved to the heap; this is a noop while it's inline.
+ * The string can't outlive the storage.
+ */
+String string_new(SmallString* storage, const char* content);
+/** Copies the viewed characters into a new String allocated from the arena. */
+String string_new(Arena* arena, StringView view);
 
 void string_clear(String string);
 void string_free(String string);
 String string_resizebuf(String string, u32 new_bufsize);
+/**
+ * Makes sure that the buffer fits at least 'at_least_length' characters. The buffer grows
+ * geometrically, so that appending to a string is amortized O(1).
+ */
 String string_ensure_fits_len(String string, u32 at_least_length);
+/** Makes sure that the buffer fits exactly 'capacity' characters, without overgrowing it. */
+String string_reserve(String string, u32 capacity);
 String string_append(String string, const char* content);
 String string_append(String string, const char chr);
+String string_append(String string, const char* content, u32 count);
 String string_copy(String string, const char* content, u32 count);
 String string_copy(String string, const char* content);
 
-StringList* string_list_add_front_dup(StringList* list, const char*);
-bool string_list_contains(StringList* list, const char*);
-void string_list_free(StringList* list);
+/** Adds a copy of 'content' to the end of the array. Both are allocated from the arena. */
+void string_array_push(Arena* arena, StringArray* array, const char* content);
+/** Reverses the order of the strings in the array. */
+void string_array_reverse(StringArray* array);
+bool string_array_contains(StringArray* array, const char* value);
 
 bool string_eq(const char* a, const char* b);
+/** Returns true if 'string' starts with 'substring'. Nothing starts with the empty string. */
 bool string_starts_with(const char* string, const char* substring);
 
+/** Returns a (non-cryptographic) hash of the content, suitable for hash table lookups. */
+u32 string_hash(const char* string);
+u32 string_hash(const char* content, u32 count);
+
+StringView string_view(const char* cstr);
+StringView string_view(const char* chars, u32 length);
+bool string_view_eq(StringView a, StringView b);
+bool string_view_eq(StringView a, const char* b);
+/** Returns true if 'view' starts with 'prefix'. Nothing starts with the empty string. */
+bool string_view_starts_with(StringView view, StringView prefix);
+/** Returns the same hash as string_hash() does for the viewed characters. */
+u32 string_view_hash(StringView view);
+
+/** Sets the content of the inline string to the first 'count' bytes of 'content'. */
+void inline_string_set(InlineString* string, const char* content, u32 count);
+/** Returns the (%nul terminated) content of the inline string. */
+char* inline_string_chars(InlineString* string);
+StringView inline_string_view(InlineString* string);
+void inline_string_free(InlineString* string);
+
+/** The implementations of the string primitives (cstrlen, string_eq, etc) */
+enum StringSimdLevel {
+    StringSimdLevel_Scalar = 0,
+    StringSimdLevel_SSE2,
+    StringSimdLevel_AVX2,
+};
+
+/** Returns the widest implementation of the string primitives that the CPU supports. */
+StringSimdLevel string_detect_simd_level();
+/**
+ * Selects the implementation of the string primitives. By default the widest one supported is
+ * used, so this is mainly for testing. Levels that the CPU doesn't support fall back to the widest
+ * one that it does.
+ */
+void string_set_simd_level(StringSimdLevel level);
+
 u32 cstrlen(const char* cstr);
 void cstrcpy(char* dest, const char* src);
 void cstrcat(char* dest, const char* src);
@@ -1,6 +1,8 @@
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "chars.h"
 #include "templates.h"
 
 enum TokenType {
@@ -12,26 +14,18 @@ enum TokenType {
     TT_End,
 };
 
-struct LinkedToken {
+struct TemplateToken {
     TokenType type = TT_None;
-    String value;
-    u32 start;
-    u32 end;
-    LinkedToken* next;
+    // Span of the token in the template. For literals this is the text to output, and for the
+    // other tokens it's the variable name (or 'else'/'end').
+    u32 start = 0;
+    u32 length = 0;
 };
 
-inline static void
-linked_token_free(LinkedToken* token)
-{
-    while (token) {
-        LinkedToken* dead = token;
-        token = token->next;
-        if (dead->value) {
-            string_free(dead->value);
-        }
-        free(dead);
-    }
-}
+struct TemplateTokens {
+    u32 count = 0;
+    TemplateToken* tokens = 0;
+};
 
 static void
 print_error(const char* message, u32 start, u32 end, String action_template)
@@ -51,354 +45,452 @@ print_error(const char* message, u32 start, u32 end, String action_template)
 }
 
 static void
-add_token_and_reset(TokenType type, String value, u32 offset, LinkedToken** head, LinkedToken** end)
+add_token(TemplateTokens* tokens, TokenType type, u32 start, u32 length)
 {
-    LinkedToken* new_token = ALLOC(LinkedToken, 1);
-    new_token->type
-        = type;
-
-    // We expect this function to be called once the entire token has been scanned,
-    // and offset pointing to the first character of the next token.
-    new_token->start = offset - string_len(value);
-    new_token->end = offset;
-    new_token->value = string_new(value);
-
-    // Set the first token in the list if it's not already set
-    if (!*head)
-        *head = new_token;
-
-    // If we have an end token set, link it with the new current before making
-    // the new token the new end.
-    if (*end)
-        (*end)->next = new_token;
-    *end = new_token;
-
-    string_clear(value);
+    TemplateToken* token = tokens->tokens + tokens->count++;
+    token->type = type;
+    token->start = start;
+    token->length = length;
 }
 
-static LinkedToken*
-tokenize_template(String action_template)
+static bool
+span_eq(const char* span, u32 span_length, const char* cstr)
 {
-    enum TokenizerMode {
-        Literal,
-        VarBlock,
-    };
+    u32 i = 0;
+    while (i < span_length && span[i] == cstr[i]) {
+        i++;
+    }
+    return i == span_length && !cstr[i];
+}
 
-    // Flag set whenever any error has ocurred during parsing
-    bool error = false;
-    // Flag set whenever a variable has been seen inside a var block
+/**
+ * Tokenizes a variable block, starting at 'offset' right after the opening '${'.
+ * Returns the offset following the block. Sets 'error' (and prints the error) if the block is invalid.
+ */
+static u32
+tokenize_var_block(String action_template, u32 offset, TemplateTokens* tokens, bool* error)
+{
+    u32 template_len = string_len(action_template);
+
+    // Flag set whenever a variable has been seen inside the var block
     bool seen_variable = false;
-    // Flag set when a $ character has been seen, expecting the next character to be either $ or {
-    bool escape_mode = false;
     // Flag set when the next pass through the loop should consume any existing whitespace
-    bool skip_next_whitespace = false;
-
-    TokenizerMode mode = Literal;
-    String curlit = string_new();
+    bool skip_next_whitespace = true;
 
-    u32 offset = 0;
-    LinkedToken* tokens = 0;
-    LinkedToken* end = 0;
+    // The name currently being read
+    u32 name_start = offset;
+    u32 name_length = 0;
 
-    while (offset < string_len(action_template) && !error) {
+    while (offset < template_len) {
         if (skip_next_whitespace) {
-            while (action_template[offset] == ' ') {
-                offset++;
-            }
+            offset = scan_while<CharClass_Space>(action_template, offset, template_len);
             skip_next_whitespace = false;
         }
 
         char c = action_template[offset];
-
-        switch (mode) {
-        case Literal:
-            if (c == '$') {
-                if (escape_mode) {
-                    escape_mode = false;
-                    curlit = string_append(curlit, "$");
-                } else {
-                    escape_mode = true;
-                }
-            } else if (c == '{') {
-                if (escape_mode) {
-                    if (string_len(curlit)) {
-                        add_token_and_reset(TT_Str, curlit, offset, &tokens, &end);
-                    }
-                    mode = VarBlock;
-                    skip_next_whitespace = true;
-                } else {
-                    curlit = string_append(curlit, c);
-                }
-                escape_mode = false;
-            } else {
-                if (escape_mode) {
-                    print_error("Unexpected character (use $$ to output a literal $)", offset, offset + 1, action_template);
-                    error = true;
-                    break;
-                } else {
-                    curlit = string_append(curlit, c);
+        if (c == '}') {
+            if (name_length) {
+                TokenType type = TT_Var;
+                if (span_eq(action_template + name_start, name_length, "else")) {
+                    type = TT_Else;
+                } else if (span_eq(action_template + name_start, name_length, "end")) {
+                    type = TT_End;
                 }
+                add_token(tokens, type, name_start, name_length);
             }
-            break;
-
-        case VarBlock:
-            if (c == '}') {
-                if (string_len(curlit)) {
-                    TokenType type = TT_Var;
-                    if (string_eq(curlit, "else")) {
-                        type = TT_Else;
-                    } else if (string_eq(curlit, "end")) {
-                        type = TT_End;
-                    }
-                    add_token_and_reset(type, curlit, offset, &tokens, &end);
-                }
-                seen_variable = false;
-                mode = Literal;
-            } else if (is_identifier_char(c)) {
-                if (seen_variable) {
-                    print_error("Only a single variable allowed per block", offset, offset + 1, action_template);
-                    error = true;
-                    break;
-                }
-                curlit = string_append(curlit, c);
-            } else if (c == '?') {
-                if (string_len(curlit) > 0) {
-                    add_token_and_reset(TT_If, curlit, offset, &tokens, &end);
-                    skip_next_whitespace = true;
-                } else {
-                    print_error("Missing variable", offset, offset + 1, action_template);
-                    error = true;
-                    break;
-                }
-                seen_variable = true;
-            } else if (c == ' ') {
-                add_token_and_reset(TT_Var, curlit, offset, &tokens, &end);
-                seen_variable = true;
-                skip_next_whitespace = true;
-            } else {
-                print_error("Unexpected character", offset, offset + 1, action_template);
-                error = true;
-                break;
+            return offset + 1;
+        } else if (char_is(c, CharClass_Identifier)) {
+            if (seen_variable) {
+                print_error("Only a single variable allowed per block", offset, offset + 1, action_template);
+                *error = true;
+                return offset;
             }
-            break;
+            if (!name_length) {
+                name_start = offset;
+            }
+            // Consume the rest of the name in one go
+            u32 name_end = scan_while<CharClass_Identifier>(action_template, offset, template_len);
+            name_length += name_end - offset;
+            offset = name_end;
+            continue;
+        } else if (c == '?') {
+            if (!name_length) {
+                print_error("Missing variable", offset, offset + 1, action_template);
+                *error = true;
+                return offset;
+            }
+            add_token(tokens, TT_If, name_start, name_length);
+            name_length = 0;
+            seen_variable = true;
+            skip_next_whitespace = true;
+        } else if (c == ' ') {
+            add_token(tokens, TT_Var, name_start, name_length);
+            name_length = 0;
+            seen_variable = true;
+            skip_next_whitespace = true;
+        } else {
+            print_error("Unexpected character", offset, offset + 1, action_template);
+            *error = true;
+            return offset;
         }
-
         offset++;
     }
 
-    if (mode == Literal) {
-        add_token_and_reset(TT_Str, curlit, offset, &tokens, &end);
-    } else if (!error) {
-        print_error("Unfinished variable block", string_len(action_template) - 1, string_len(action_template), action_template);
-        error = true;
-    }
-
-    string_free(curlit);
-
-    if (error) {
-        linked_token_free(tokens);
-        return 0;
-    }
-
-    return tokens;
-}
-
-static String
-get_truthy_value(VarList* vars, const char* name)
-{
-    String value = template_get(vars, name);
-    return value && !string_eq(value, "") ? value : 0;
+    print_error("Unfinished variable block", template_len - 1, template_len, action_template);
+    *error = true;
+    return offset;
 }
 
+/**
+ * Splits the template into tokens. The tokens refer to spans of the template rather than holding
+ * copies of the text, and are all stored in a single array.
+ *
+ * Returns true if successful. Otherwise the error is printed and false is returned.
+ */
 static bool
-_process_conditional(
-    LinkedToken** tokens,
-    VarList* vars,
-    String action_template,
-    bool skip_all,
-    String* result_out)
+tokenize_template(String action_template, TemplateTokens* result)
 {
-    LinkedToken* token = (*tokens);
+    u32 template_len = string_len(action_template);
+
+    // Every token except the last one spans at least two characters of the template (a literal is
+    // either ended by a "$$", or followed by a "${" block), which bounds the number of tokens.
+    TemplateTokens tokens = {};
+    tokens.tokens = ALLOC(TemplateToken, template_len / 2 + 2);
+    assert(tokens.tokens);
 
     bool error = false;
-    bool seen_else = false;
-    bool seen_end = false;
-
-    assert(token->type == TT_If);
-    bool skip_block = get_truthy_value(vars, token->value) == 0;
-
-    while ((token = token->next)) {
-        skip_block = skip_all || skip_block;
-
-        if (token->type == TT_Str) {
-            if (skip_block)
-                continue;
-            *result_out = string_append(*result_out, token->value);
-        } else if (token->type == TT_Var) {
-            if (skip_block)
-                continue;
-            String value = get_truthy_value(vars, token->value);
-            if (value) {
-                *result_out = string_append(*result_out, value);
-            }
-        } else if (token->type == TT_If) {
-            if (!_process_conditional(&token, vars, action_template, skip_block, result_out)) {
-                error = true;
-                break;
+    u32 offset = 0;
+    u32 literal_start = 0;
+    while (offset < template_len && !error) {
+        // Everything up until the next '$' is literal text. Look for it using memchr, which is
+        // vectorized, instead of inspecting the literal one character at a time.
+        const char* dollar = (const char*)memchr(action_template + offset, '$', template_len - offset);
+        if (!dollar) {
+            offset = template_len;
+            break;
+        }
+        offset = (u32)(dollar - action_template);
+
+        char next = action_template[offset + 1];
+        if (offset + 1 == template_len) {
+            // NOTE(christoffer) A single '$' at the very end of the template is dropped
+            if (offset > literal_start) {
+                add_token(&tokens, TT_Str, literal_start, offset - literal_start);
             }
-        } else if (token->type == TT_Else) {
-            if (seen_else) {
-                print_error("Too many ${else} blocks", token->start, token->end, action_template);
-                error = true;
-                break;
+            literal_start = template_len;
+            offset = template_len;
+        } else if (next == '$') {
+            // An escaped '$'. Keep the first one as the end of the current literal, and start the
+            // next literal after the second one.
+            add_token(&tokens, TT_Str, literal_start, offset + 1 - literal_start);
+            offset += 2;
+            literal_start = offset;
+        } else if (next == '{') {
+            if (offset > literal_start) {
+                add_token(&tokens, TT_Str, literal_start, offset - literal_start);
             }
-            seen_else = true;
-            skip_block = !skip_block;
-        } else if (token->type == TT_End) {
-            seen_end = true;
-            break;
+            offset = tokenize_var_block(action_template, offset + 2, &tokens, &error);
+            literal_start = offset;
+        } else {
+            print_error("Unexpected character (use $$ to output a literal $)", offset + 1, offset + 2, action_template);
+            error = true;
         }
     }
 
-    // Write the token to the caller to continue from
-    *tokens = token;
-
-    // The missing end is a special error case that we can't detect in the
-    // loop. Instead we detect it by exiting the loop without any other error,
-    // but without ever seening an END block.
-    if (!error && !seen_end) {
-        print_error("Missing ${end}", string_len(action_template) - 1, string_len(action_template), action_template);
+    if (error) {
+        free(tokens.tokens);
         return false;
     }
 
-    return !error;
+    if (literal_start < template_len) {
+        add_token(&tokens, TT_Str, literal_start, template_len - literal_start);
+    }
+    *result = tokens;
+    return true;
+}
+
+/**
+ * Returns the table slot for the variable. This is either the slot holding the variable, or the
+ * empty slot where it would be inserted. The table must have been allocated.
+ */
+static u32
+find_var_slot(VarMap* vars, NameId name)
+{
+    u32 mask = vars->table_capacity - 1;
+    u32 slot = intern_hash(name) & mask;
+    while (vars->table[slot] && vars->entries[vars->table[slot] - 1].name != name) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
 }
 
-VarList*
-template_set(VarList* head, const char* varname, const char* varvalue)
+void template_reserve(VarMap* vars, u32 count)
 {
-    VarList* node = head;
-    VarList* end = 0;
+    if (count > vars->capacity) {
+        u32 capacity = vars->capacity ? vars->capacity : 8;
+        while (capacity < count) {
+            capacity *= 2;
+        }
+        vars->entries = (VarEntry*)realloc(vars->entries, capacity * sizeof(VarEntry));
+        assert(vars->entries);
+        vars->capacity = capacity;
+    }
+
+    // Keep the table at most half full to keep the probe sequences short
+    if (count * 2 > vars->table_capacity) {
+        u32 table_capacity = vars->table_capacity ? vars->table_capacity : 16;
+        while (table_capacity < count * 2) {
+            table_capacity *= 2;
+        }
+        free(vars->table);
+        vars->table = ALLOC(u32, table_capacity);
+        assert(vars->table);
+        vars->table_capacity = table_capacity;
 
-    while (node && !string_eq(node->name, varname)) {
-        end = node;
-        node = node->next;
+        for (u32 i = 0; i < vars->count; i++) {
+            vars->table[find_var_slot(vars, vars->entries[i].name)] = i + 1;
+        }
     }
+}
 
-    if (node) {
+void template_set(VarMap* vars, NameId name, StringView value)
+{
+    template_reserve(vars, vars->count + 1);
+
+    u32 slot = find_var_slot(vars, name);
+    VarEntry* entry;
+    if (vars->table[slot]) {
         // Overwrite the value of the existing variable with the same name
-        node->value = string_copy(node->value, varvalue);
+        entry = vars->entries + vars->table[slot] - 1;
     } else {
-        // No existing node found, create a new one and append it to the end
-        node = ALLOC(VarList, 1);
-        node->name = string_new(varname);
-        node->value = string_new(varvalue);
-        if (end) {
-            end->next = node;
-        }
+        entry = vars->entries + vars->count++;
+        *entry = {};
+        entry->name = name;
+        vars->table[slot] = vars->count;
     }
+    inline_string_set(&entry->value, value.chars, value.length);
+}
+
+void template_set(VarMap* vars, StringView name, StringView value)
+{
+    template_set(vars, intern(name), value);
+}
 
-    return head ? head : node;
+void template_set(VarMap* vars, const char* name, const char* value)
+{
+    template_set(vars, intern(name), string_view(value));
 }
 
-VarList*
-template_merge(VarList* base, VarList* extended)
+void template_free(VarMap* vars)
 {
-    VarList* result = 0;
-    VarList* varptr = base;
-    while (varptr) {
-        result = template_set(result, varptr->name, varptr->value);
-        varptr = varptr->next;
+    for (u32 i = 0; i < vars->count; i++) {
+        inline_string_free(&vars->entries[i].value);
     }
-    varptr = extended;
-    while (varptr) {
-        result = template_set(result, varptr->name, varptr->value);
-        varptr = varptr->next;
+    free(vars->entries);
+    free(vars->table);
+    *vars = {};
+}
+
+char* template_get(VarMap* vars, NameId name)
+{
+    if (!vars->count || !name) {
+        return 0;
     }
+    u32 slot = find_var_slot(vars, name);
+    return vars->table[slot] ? inline_string_chars(&vars->entries[vars->table[slot] - 1].value) : 0;
+}
 
-    return result;
+char* template_get(VarMap* vars, StringView name)
+{
+    // A name that has never been interned can't have been set
+    return template_get(vars, intern_lookup(name));
 }
 
-void template_free(VarList* node)
+char* template_get(VarMap* vars, const char* name)
 {
-    while (node) {
-        string_free(node->name);
-        string_free(node->value);
-        VarList* dead = node;
-        node = node->next;
-        free(dead);
-    }
+    return template_get(vars, string_view(name));
 }
 
-String
-template_get(VarList* node, const char* name)
+char* template_get(const VarScope* scope, NameId name)
 {
-    while (node) {
-        if (string_eq(node->name, name)) {
-            return node->value;
+    for (; scope; scope = scope->parent) {
+        char* value = scope->vars ? template_get(scope->vars, name) : scope->lookup(scope->source, name);
+        if (value) {
+            return value;
         }
-        node = node->next;
     }
     return 0;
 }
 
-String
-template_generate_usage(String action_template, const char* action_name)
+/**
+ * Returns the slot of the variable named by the span, and adds a slot for the variable if this is
+ * the first reference to it. 'slot_table' is an open addressing table of (slot + 1) values for
+ * the named variables.
+ */
+static u32
+resolve_slot(CompiledTemplate* compiled, u32 start, u32 length, u32* slot_table, u32 table_capacity)
 {
-    LinkedToken* tokens = tokenize_template(action_template);
-    if (!tokens) {
-        return 0;
+    const char* first_char = compiled->action_template + start;
+    if (length == 1 && char_is(*first_char, CharClass_Digit)) {
+        // Positional variables always map to the slot with the same number
+        u32 slot = (u32)(*first_char - '0');
+        if (!compiled->slots[slot].length) {
+            compiled->slots[slot].start = start;
+            compiled->slots[slot].length = length;
+            compiled->slots[slot].name = intern(string_view(first_char, length));
+        }
+        return slot;
+    }
+
+    // Once the name is interned, the slots are found by comparing handles
+    NameId name = intern(string_view(first_char, length));
+    u32 mask = table_capacity - 1;
+    u32 position = intern_hash(name) & mask;
+    while (slot_table[position]) {
+        if (compiled->slots[slot_table[position] - 1].name == name) {
+            return slot_table[position] - 1;
+        }
+        position = (position + 1) & mask;
+    }
+
+    u32 slot = compiled->num_slots++;
+    compiled->slots[slot].start = start;
+    compiled->slots[slot].length = length;
+    compiled->slots[slot].name = name;
+    slot_table[position] = slot + 1;
+    return slot;
+}
+
+bool template_compile(String action_template, CompiledTemplate* compiled)
+{
+    *compiled = {};
+
+    TemplateTokens tokens = {};
+    if (!tokenize_template(action_template, &tokens)) {
+        return false;
+    }
+
+    // Every token compiles to at most one instruction, and can open at most one block
+    u32 num_tokens = tokens.count;
+    TemplateInstruction* instructions = ALLOC(TemplateInstruction, num_tokens + 1);
+    assert(instructions);
+
+    // Stack of the currently open conditional blocks. Each entry is the position of the
+    // instruction that jumps past the current branch of the block. This is either the
+    // conditional jump of the ${x?}, or the jump emitted at the ${else} (once it's been seen).
+    u32* open_blocks = ALLOC(u32, num_tokens + 1);
+    assert(open_blocks);
+    u32 depth = 0;
+
+    // Every variable token can add at most one slot (on top of the positional ones)
+    compiled->action_template = action_template;
+    compiled->num_slots = TEMPLATE_POSITIONAL_SLOTS;
+    compiled->slots = ALLOC(TemplateSlot, TEMPLATE_POSITIONAL_SLOTS + num_tokens);
+    assert(compiled->slots);
+    u32 slot_table_capacity = 16;
+    while (slot_table_capacity < num_tokens * 2) {
+        slot_table_capacity *= 2;
     }
+    u32* slot_table = ALLOC(u32, slot_table_capacity);
+    assert(slot_table);
 
-    u8 seen_pos[10] = { 0 };
-    bool has_pos_args = false;
-
-    String named_arg_desc = string_new();
-    StringList* seen_names = 0;
-    bool has_named_vars = false;
-
-    LinkedToken* tok = tokens;
-    while (tok) {
-        if ((tok->type == TT_If) || (tok->type == TT_Var)) {
-            if (string_len(tok->value) == 1 && (is_digit(*tok->value))) {
-                // Collect all of the seen positional arguments and loop over them in
-                // position order afterward. They can appear in any order in the template,
-                // but the order is (obviously) fixed on the command line.
-                seen_pos[*tok->value - '0'] = 1;
-                has_pos_args = true;
+    u32 count = 0;
+    bool error = false;
+    for (u32 i = 0; i < num_tokens && !error; i++) {
+        TemplateToken* token = tokens.tokens + i;
+        TemplateInstruction* instruction = instructions + count;
+        instruction->start = token->start;
+        instruction->length = token->length;
+        switch (token->type) {
+        case TT_Str:
+            instruction->op = TemplateOp_Literal;
+            count++;
+            break;
+        case TT_Var:
+            instruction->op = TemplateOp_Var;
+            instruction->slot = resolve_slot(compiled, token->start, token->length, slot_table, slot_table_capacity);
+            count++;
+            break;
+        case TT_If:
+            instruction->op = TemplateOp_JumpIfFalsy;
+            instruction->slot = resolve_slot(compiled, token->start, token->length, slot_table, slot_table_capacity);
+            open_blocks[depth++] = count++;
+            break;
+        case TT_Else:
+            if (!depth) {
+                print_error("Unexpected ${else} block", token->start, token->start + token->length, action_template);
+                error = true;
+            } else if (instructions[open_blocks[depth - 1]].op == TemplateOp_Jump) {
+                print_error("Too many ${else} blocks", token->start, token->start + token->length, action_template);
+                error = true;
             } else {
-                if (!string_list_contains(seen_names, tok->value)) {
-                    named_arg_desc = string_append(named_arg_desc, " [--");
-                    named_arg_desc = string_append(named_arg_desc, tok->value);
-                    named_arg_desc = string_append(named_arg_desc, " <value>]");
-                    seen_names = string_list_add_front_dup(seen_names, tok->value);
-                    has_named_vars = true;
-                }
+                // The end of the 'true' branch jumps past the 'false' branch, which starts
+                // right after this instruction.
+                instruction->op = TemplateOp_Jump;
+                instruction->length = 0;
+                instructions[open_blocks[depth - 1]].target = count + 1;
+                open_blocks[depth - 1] = count++;
             }
+            break;
+        case TT_End:
+            if (!depth) {
+                print_error("Unexpected ${end} block", token->start, token->start + token->length, action_template);
+                error = true;
+            } else {
+                instructions[open_blocks[--depth]].target = count;
+            }
+            break;
+        case TT_None:
+            assert(false);
         }
-        tok = tok->next;
     }
-    string_list_free(seen_names);
-    linked_token_free(tokens);
 
+    if (!error && depth) {
+        print_error("Missing ${end}", string_len(action_template) - 1, string_len(action_template), action_template);
+        error = true;
+    }
+
+    free(slot_table);
+    free(open_blocks);
+    free(tokens.tokens);
+
+    compiled->instructions = instructions;
+    compiled->num_instructions = count;
+    if (error) {
+        template_compiled_free(compiled);
+        return false;
+    }
+    return true;
+}
+
+void template_compiled_free(CompiledTemplate* compiled)
+{
+    free(compiled->instructions);
+    free(compiled->slots);
+    *compiled = {};
+}
+
+String
+template_generate_usage(CompiledTemplate* compiled, const char* action_name)
+{
     String result = string_new("Usage: ");
     result = string_append(result, action_name);
 
-    if (has_pos_args) {
-        String pos_arg_desc = string_new();
-        for (u8 i = 0; i < 10; i++) {
-            if (seen_pos[i]) {
-                pos_arg_desc = string_append(pos_arg_desc, " $");
-                pos_arg_desc = string_append(pos_arg_desc, (char)('0' + i));
-            }
+    // Positional variables have fixed slots. They can appear in any order in the template,
+    // but the order is (obviously) fixed on the command line.
+    for (u32 i = 0; i < TEMPLATE_POSITIONAL_SLOTS; i++) {
+        if (compiled->slots[i].length) {
+            result = string_append(result, " $");
+            result = string_append(result, (char)('0' + i));
         }
-        result = string_append(result, pos_arg_desc);
-        string_free(pos_arg_desc);
     }
 
-    if (has_named_vars) {
-        result = string_append(result, named_arg_desc);
-        string_free(named_arg_desc);
+    // Named variables have a slot each, in the order that they're first referenced
+    for (u32 i = TEMPLATE_POSITIONAL_SLOTS; i < compiled->num_slots; i++) {
+        TemplateSlot* slot = compiled->slots + i;
+        result = string_append(result, " [--");
+        result = string_append(result, compiled->action_template + slot->start, slot->length);
+        result = string_append(result, " <value>]");
     }
 
     result = string_append(result, '\n');
@@ -406,51 +498,91 @@ template_generate_usage(String action_template, const char* action_name)
 }
 
 String
-template_render(String action_template, VarList* vars)
+template_generate_usage(String action_template, const char* action_name)
 {
-    LinkedToken* tokens = tokenize_template(action_template);
-
-    if (!tokens) {
-        // Failed to tokenize the template string
+    CompiledTemplate compiled = {};
+    if (!template_compile(action_template, &compiled)) {
         return 0;
     }
+    String result = template_generate_usage(&compiled, action_name);
+    template_compiled_free(&compiled);
+    return result;
+}
+
+void template_bind(CompiledTemplate* compiled, const VarScope* scope, char** slot_values)
+{
+    for (u32 i = 0; i < compiled->num_slots; i++) {
+        TemplateSlot* slot = compiled->slots + i;
+        slot_values[i] = slot->name ? template_get(scope, slot->name) : 0;
+    }
+}
 
+String
+template_render(CompiledTemplate* compiled, char** slot_values)
+{
+    // The rendered command is usually about as long as the template, so reserve that up front
     String result = string_new();
-    bool error = false;
-    LinkedToken* curtok = tokens;
-    while (curtok) {
-        // printf("Token main loop: %d [%s]\n", curtok->type, curtok->value);
-        if (curtok->type == TT_If) {
-            if (!_process_conditional(&curtok, vars, action_template, false, &result)) {
-                error = true;
-                break;
-            }
-        } else if (curtok->type == TT_Str) {
-            result = string_append(result, curtok->value);
-        } else if (curtok->type == TT_Else) {
-            print_error("Unexpected ${else} block", curtok->start, curtok->end, action_template);
-            error = true;
+    result = string_reserve(result, string_len(compiled->action_template));
+
+    // All jump targets are resolved at compile time, so a branch that isn't taken is skipped
+    // in a single step regardless of how much it contains. Variables are read straight from
+    // their slots.
+    u32 pc = 0;
+    while (pc < compiled->num_instructions) {
+        TemplateInstruction* instruction = compiled->instructions + pc;
+        switch (instruction->op) {
+        case TemplateOp_Literal:
+            result = string_append(result, compiled->action_template + instruction->start, instruction->length);
+            pc++;
             break;
-        } else if (curtok->type == TT_End) {
-            print_error("Unexpected ${end} block", curtok->start, curtok->end, action_template);
-            error = true;
-            break;
-        } else if (curtok->type == TT_Var) {
-            String value = get_truthy_value(vars, curtok->value);
+        case TemplateOp_Var: {
+            char* value = slot_values[instruction->slot];
             if (value) {
                 result = string_append(result, value);
             }
+            pc++;
+        } break;
+        case TemplateOp_JumpIfFalsy: {
+            char* value = slot_values[instruction->slot];
+            pc = (value && *value) ? pc + 1 : instruction->target;
+        } break;
+        case TemplateOp_Jump:
+            pc = instruction->target;
+            break;
         }
-
-        curtok = curtok->next;
     }
 
-    if (error) {
-        string_free(result);
-        result = 0;
-    }
+    return result;
+}
+
+String
+template_render(CompiledTemplate* compiled, const VarScope* scope)
+{
+    char** slot_values = ALLOC(char*, compiled->num_slots);
+    assert(slot_values);
+    template_bind(compiled, scope, slot_values);
+    String result = template_render(compiled, slot_values);
+    free(slot_values);
+    return result;
+}
 
-    linked_token_free(tokens);
+String
+template_render(CompiledTemplate* compiled, VarMap* vars)
+{
+    VarScope scope = {};
+    scope.vars = vars;
+    return template_render(compiled, &scope);
+}
 
+String
+template_render(String action_template, VarMap* vars)
+{
+    CompiledTemplate compiled = {};
+    if (!template_compile(action_template, &compiled)) {
+        // Failed to compile the template string
+        return 0;
+    }
+    String result = template_render(&compiled, vars);
+    template_compiled_free(&compiled);
     return result;
 }
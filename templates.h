@@ -1,45 +1,172 @@
 #pragma once
 
+#include "intern.h"
 #include "string.h"
 
-struct VarList {
-    String name = 0;
-    String value = 0;
-    VarList* next = 0;
+struct VarEntry {
+    NameId name = 0;
+    InlineString value = {};
 };
 
 /**
- * Set the variable with 'name' to 'value'. If a variable with 'name' already
- * exists, it's overwritten. Otherwise the new variable is appended at the end.
+ * A set of template variables (name => value).
+ *
+ * The entries are kept in insertion order in a dense array, and found through an open
+ * addressing hash table of entry positions. The names are interned, so finding an entry only
+ * compares handles. Short values are stored inline in the entries, so most variables don't need
+ * any allocations of their own.
+ *
+ * A zero initialized VarMap is an empty set of variables.
+ */
+struct VarMap {
+    u32 count = 0;
+    u32 capacity = 0;
+    VarEntry* entries = 0;
+
+    // Positions in 'entries' (plus one, 0 marks an empty slot)
+    u32 table_capacity = 0;
+    u32* table = 0;
+};
+
+/**
+ * Looks up a variable in a source that doesn't keep its variables in a VarMap (e.g. the defaults
+ * of a compiled config file). Returns 0 if the variable isn't set in the source.
+ */
+typedef char* (*VarLookup)(const void* source, NameId name);
+
+/**
+ * A layer in a chain of variable scopes, e.g. command line variables on top of the defaults of a
+ * config file. A lookup falls through to the parent scope when the variable isn't set in this
+ * one, so the variables never have to be copied between layers.
+ *
+ * The variables of a scope are either in 'vars', or found using 'lookup' on 'source'.
+ */
+struct VarScope {
+    VarMap* vars = 0;
+    VarLookup lookup = 0;
+    const void* source = 0;
+    const VarScope* parent = 0;
+};
+
+enum TemplateOp {
+    // Output the literal text of the span
+    TemplateOp_Literal = 0,
+    // Output the value of the variable named by the span (if set)
+    TemplateOp_Var,
+    // Continue at 'target' unless the variable named by the span is set to a non-empty value
+    TemplateOp_JumpIfFalsy,
+    // Continue at 'target'
+    TemplateOp_Jump,
+};
+
+struct TemplateInstruction {
+    TemplateOp op = TemplateOp_Literal;
+    // Span of the literal text or variable name in the template string
+    u32 start = 0;
+    u32 length = 0;
+    // The slot of the variable (for TemplateOp_Var and TemplateOp_JumpIfFalsy)
+    u32 slot = 0;
+    u32 target = 0;
+};
+
+// The positional variables ${0} to ${9} always use the slots 0 to 9
+#define TEMPLATE_POSITIONAL_SLOTS 10
+
+/** A variable referenced by a compiled template. The span is the first reference to the variable. */
+struct TemplateSlot {
+    u32 start = 0;
+    u32 length = 0;
+    // The interned name of the variable (0 for positional slots that aren't referenced)
+    NameId name = 0;
+};
+
+/**
+ * A template compiled to a flat list of instructions. The ${x?}, ${else} and ${end} blocks are
+ * compiled to jumps, with all targets resolved when the template is compiled.
+ *
+ * Each distinct variable is given a slot, and the instructions refer to the variables by slot. The
+ * positional variables have fixed slots, followed by the named variables in the order they're
+ * first referenced. Slots for positional variables that aren't referenced have an empty span.
+ *
+ * The instructions refer to the template string rather than copying from it, so the template
+ * string must outlive the compiled template.
  */
-VarList* template_set(VarList* vars, const char* name, const char* value);
+struct CompiledTemplate {
+    String action_template = 0;
+    u32 num_instructions = 0;
+    TemplateInstruction* instructions = 0;
+    u32 num_slots = 0;
+    TemplateSlot* slots = 0;
+};
 
 /**
- * Merges the 'extended' list of variables into the 'base' list of variables and
- * returns a pointer to a new VarList that contains the merged set of the two.
- * If a name exists in both base and extended, the value will be overwritten by
- * the value in 'extended'.
+ * Set the variable with 'name' to 'value'. If a variable with 'name' already
+ * exists, it's overwritten. Otherwise the new variable is added after the existing ones.
  *
- * It's up to the caller to free the memory of the returned VarList list.
+ * NOTE(christoffer) Adding variables can move the existing entries, so any value returned by
+ * template_get() is only valid until the next call to template_set().
  */
-VarList* template_merge(VarList* base, VarList* extended);
+void template_set(VarMap* vars, NameId name, StringView value);
+void template_set(VarMap* vars, StringView name, StringView value);
+void template_set(VarMap* vars, const char* name, const char* value);
+
+/** Makes room for at least 'count' variables in total, without having to grow the map again. */
+void template_reserve(VarMap* vars, u32 count);
 
-/** Goes through the list of variables and calls string_free() on each name and value. */
-void template_free(VarList* vars);
+/** Frees all the variables, and leaves the map empty. */
+void template_free(VarMap* vars);
 
 /**
- * Search through the template variables, stopping once a variable with 'name' has
- * been found and returns the corresponding value.
+ * Looks up the variable with 'name' and returns the corresponding value.
  * Returns 0 if no variable with 'name' was found.
  */
-String template_get(VarList* vars, const char* name);
+char* template_get(VarMap* vars, const char* name);
+char* template_get(VarMap* vars, NameId name);
+char* template_get(VarMap* vars, StringView name);
+
+/** Looks up the variable in the scope and then in each parent in turn. Returns 0 if none has it. */
+char* template_get(const VarScope* scope, NameId name);
+
+/**
+ * Compiles the template string. Any syntax error is printed, and false is returned.
+ * The compiled template should be freed using template_compiled_free().
+ */
+bool template_compile(String action_template, CompiledTemplate* compiled);
+
+/** Frees all resources claimed by the compiled template. */
+void template_compiled_free(CompiledTemplate* compiled);
+
+/**
+ * Looks up the value of each slot in the scope, and writes it to 'slot_values' (or 0 if the
+ * variable isn't set). 'slot_values' must have room for compiled->num_slots values.
+ *
+ * Each variable is looked up once, no matter how many times the template references it.
+ */
+void template_bind(CompiledTemplate* compiled, const VarScope* scope, char** slot_values);
+
+/**
+ * Returns the template with variables substituted using the values of the slots.
+ */
+String template_render(CompiledTemplate* compiled, char** slot_values);
+
+/**
+ * Returns the template with variables substituted using values from the scope (or variable set).
+ */
+String template_render(CompiledTemplate* compiled, const VarScope* scope);
+String template_render(CompiledTemplate* compiled, VarMap* vars);
+
+/**
+ * Compiles and renders the template string. Returns 0 if the template couldn't be compiled.
+ */
+String template_render(String action_template, VarMap* vars);
 
 /**
- * Returns the template with variables substituted using values from the variable set.
+ * Returns a string with an autogenerated usage string for the template.
  */
-String template_render(String action_template, VarList* vars);
+String template_generate_usage(CompiledTemplate* compiled, const char* action_name);
 
 /**
- * Returns a string with an autogenerated usage string for the template string.
+ * Compiles the template string and returns the autogenerated usage string for it.
+ * Returns 0 if the template couldn't be compiled.
  */
 String template_generate_usage(String action_template, const char* action_name);
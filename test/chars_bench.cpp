@@ -0,0 +1,108 @@
+// Compares classifying characters through the shared class table (chars.h) with the range check
+// macros it replaced.
+//
+// Scans a config-like buffer for identifiers and whitespace with both, the same way the config
+// parser does, and prints the time per scanned byte. Both scans must find the same boundaries.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../chars.h"
+
+#define MB (1024 * 1024)
+#define ROUNDS 20
+
+#define is_alpha(c) ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+#define is_digit(c) (c >= '0' && c <= '9')
+#define is_identifier_char(c) (is_alpha(c) || is_digit(c) || c == '-' || c == '_')
+
+static double
+now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static u32
+fill_config(char* buffer, u32 size)
+{
+    const char line[] = "  some-action_name = echo ${0} ${name?}--name ${name}${end}\n";
+    u32 len = 0;
+    while (len + sizeof(line) < size) {
+        for (u32 i = 0; i < sizeof(line) - 1; i++) {
+            buffer[len++] = line[i];
+        }
+    }
+    buffer[len] = '\0';
+    return len;
+}
+
+// Both scanners return a checksum of the boundaries they found, so that the scans can't be
+// optimized away and the results can be compared.
+
+static u64
+scan_with_macros(const char* content, u32 len)
+{
+    u64 checksum = 0;
+    u32 offset = 0;
+    while (offset < len) {
+        while (offset < len && content[offset] == ' ') {
+            offset++;
+        }
+        u32 start = offset;
+        while (offset < len && is_identifier_char(content[offset])) {
+            offset++;
+        }
+        checksum += offset - start;
+        offset++;
+    }
+    return checksum;
+}
+
+static u64
+scan_with_table(const char* content, u32 len)
+{
+    u64 checksum = 0;
+    u32 offset = 0;
+    while (offset < len) {
+        offset = scan_while<CharClass_Space>(content, offset, len);
+        u32 start = offset;
+        offset = scan_while<CharClass_Identifier>(content, offset, len);
+        checksum += offset - start;
+        offset++;
+    }
+    return checksum;
+}
+
+int main()
+{
+    char* buffer = (char*)malloc(16 * MB);
+    assert(buffer);
+    u32 len = fill_config(buffer, 16 * MB);
+
+    u64 macro_checksum = 0, table_checksum = 0;
+    double start = now_seconds();
+    for (u32 i = 0; i < ROUNDS; i++) {
+        macro_checksum += scan_with_macros(buffer, len);
+    }
+    double macro_elapsed = now_seconds() - start;
+
+    start = now_seconds();
+    for (u32 i = 0; i < ROUNDS; i++) {
+        table_checksum += scan_with_table(buffer, len);
+    }
+    double table_elapsed = now_seconds() - start;
+
+    printf("macros: %.3f ns/byte\n", macro_elapsed * 1e9 / ((double)len * ROUNDS));
+    printf("table:  %.3f ns/byte\n", table_elapsed * 1e9 / ((double)len * ROUNDS));
+    free(buffer);
+
+    if (macro_checksum != table_checksum) {
+        printf("The scans found different boundaries\n");
+        return 1;
+    }
+    return 0;
+}
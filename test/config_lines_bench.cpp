@@ -0,0 +1,155 @@
+// Compares classifying config lines a block at a time (config_lines.h) with scanning them one
+// character at a time, the way the config parser did before.
+//
+// Splits a multi-megabyte config into lines and classifies every line with both, and prints the
+// time per line. Both must classify every line the same way, with the same columns.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../config_lines.h"
+
+#define MB (1024 * 1024)
+#define ROUNDS 10
+
+static double
+now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Lines in the same mix as the scaling test (test/parse_scaling.py), plus some indented ones
+static u32
+fill_config(char* buffer, u32 size, u32* num_lines)
+{
+    u32 len = 0;
+    *num_lines = 0;
+    while (len + 256 < size) {
+        u32 i = *num_lines;
+        const char* format;
+        if (i % 10 == 0) {
+            format = "# comment line %u\n";
+        } else if (i % 10 == 1) {
+            format = "default-%u := value\n";
+        } else if (i % 10 == 2) {
+            format = "    indented-action-%u   =   echo \"${0}\"\n";
+        } else if (i % 10 == 3) {
+            format = "\n";
+        } else {
+            format = "action-%u = echo \"${0}\" ${name?}--name ${name}${end}\n";
+        }
+        len += (u32)snprintf(buffer + len, size - len, format, i);
+        (*num_lines)++;
+    }
+    return len;
+}
+
+static ConfigLineKind
+classify_with_scalar_scan(StringView line, ConfigLineColumns* columns)
+{
+    u32 offset = scan_while<CharClass_Space>(line.chars, 0, line.length);
+    if (offset == line.length) {
+        return ConfigLineKind_Blank;
+    } else if (line.chars[offset] == '#') {
+        return ConfigLineKind_Comment;
+    }
+
+    u32 name_end = scan_while<CharClass_Identifier>(line.chars, offset, line.length);
+    if (name_end == offset) {
+        return ConfigLineKind_Other;
+    }
+    columns->name_start = offset;
+    columns->name_end = name_end;
+
+    ConfigLineKind kind;
+    offset = scan_while<CharClass_Space>(line.chars, name_end, line.length);
+    if (offset < line.length && line.chars[offset] == '=') {
+        kind = ConfigLineKind_Action;
+        offset += 1;
+    } else if (offset + 1 < line.length && line.chars[offset] == ':' && line.chars[offset + 1] == '=') {
+        kind = ConfigLineKind_Variable;
+        offset += 2;
+    } else {
+        return ConfigLineKind_Other;
+    }
+    columns->value_start = scan_while<CharClass_Space>(line.chars, offset, line.length);
+    return kind;
+}
+
+// Only splits the lines, to tell the time spent classifying them apart from the time spent
+// finding them
+static ConfigLineKind
+split_only(StringView line, ConfigLineColumns*)
+{
+    return line.length ? ConfigLineKind_Other : ConfigLineKind_Blank;
+}
+
+// Both classifiers return a checksum of the kinds and columns they found, so that the scans
+// can't be optimized away and the results can be compared.
+
+template <ConfigLineKind (*Classify)(StringView, ConfigLineColumns*)>
+static u64
+classify_lines(const char* content, u32 len)
+{
+    u64 checksum = 0;
+    u32 offset = 0;
+    while (offset < len) {
+        const char* newline = (const char*)memchr(content + offset, '\n', len - offset);
+        u32 line_end = newline ? (u32)(newline - content) : len;
+        ConfigLineColumns columns;
+        ConfigLineKind kind = Classify(string_view(content + offset, line_end - offset), &columns);
+        checksum = checksum * 31 + kind;
+        if (kind == ConfigLineKind_Action || kind == ConfigLineKind_Variable) {
+            checksum = checksum * 31 + columns.name_start + (columns.name_end << 8) + (columns.value_start << 16);
+        }
+        offset = line_end + 1;
+    }
+    return checksum;
+}
+
+int main()
+{
+    u32 size = 16 * MB;
+    char* buffer = (char*)malloc(size);
+    assert(buffer);
+    u32 num_lines = 0;
+    u32 len = fill_config(buffer, size, &num_lines);
+
+    u64 split_checksum = 0, scalar_checksum = 0, block_checksum = 0;
+    double start = now_seconds();
+    for (u32 i = 0; i < ROUNDS; i++) {
+        split_checksum += classify_lines<split_only>(buffer, len);
+    }
+    double split_elapsed = now_seconds() - start;
+
+    start = now_seconds();
+    for (u32 i = 0; i < ROUNDS; i++) {
+        scalar_checksum += classify_lines<classify_with_scalar_scan>(buffer, len);
+    }
+    double scalar_elapsed = now_seconds() - start;
+
+    start = now_seconds();
+    for (u32 i = 0; i < ROUNDS; i++) {
+        block_checksum += classify_lines<classify_config_line>(buffer, len);
+    }
+    double block_elapsed = now_seconds() - start;
+
+    // The time to split the lines is subtracted, so that only the classification is compared
+    double lines = (double)num_lines * ROUNDS;
+    printf("%u lines, %.1f MB (splitting: %.2f ns/line)\n", num_lines, (double)len / MB, split_elapsed * 1e9 / lines);
+    printf("scalar: %.2f ns/line\n", (scalar_elapsed - split_elapsed) * 1e9 / lines);
+    printf("blocks: %.2f ns/line\n", (block_elapsed - split_elapsed) * 1e9 / lines);
+    free(buffer);
+    (void)split_checksum;
+
+    if (scalar_checksum != block_checksum) {
+        printf("The classifications differ\n");
+        return 1;
+    }
+    return 0;
+}
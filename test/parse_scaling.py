@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+#
+# Verifies that config parsing scales linearly with the number of lines in the config file.
+#
+# Generates configs from 1k to 1M action lines and times how long it takes qs to parse each
+# of them while looking for an action that isn't defined (forcing a full parse of the file).
+# A linear parser should take roughly 10x longer for every 10x lines, a quadratic one 100x.
+
+import os
+import shutil
+import subprocess
+import tempfile
+import time
+
+from test_framework import CGREEN, CRED, CEND, source_root
+
+LINE_COUNTS = [1000, 10000, 100000, 1000000]
+RUNS_PER_SIZE = 3
+
+# Allowed growth in parse time per 10x lines. Generous to account for noise and cache
+# effects, but well below the 100x a quadratic parser would show.
+MAX_GROWTH_PER_10X = 25.0
+
+# Below this duration the measurement is dominated by process startup, so the growth
+# between two sizes isn't meaningful.
+MIN_MEASURABLE_SECONDS = 0.02
+
+
+def write_config(path, num_lines):
+    with open(path, 'w') as f:
+        for i in range(num_lines):
+            if i % 10 == 0:
+                f.write('# comment line %d\n' % i)
+            elif i % 10 == 1:
+                # Redefine a small set of defaults, the number of distinct variables isn't
+                # what's being measured here.
+                f.write('default-%d := value %d\n' % (i % 8, i))
+            else:
+                f.write('action-%d = echo "${0} %d" ${name?}--name ${name}${end}\n' % (i, i))
+
+
+def time_parse(binary, root, config_path):
+    best = None
+    # Every run starts with an empty cache, otherwise only the first one would parse the config
+    # (the others would load its compiled form from the cache)
+    cache_home = os.path.join(root, 'cache')
+    env = {'HOME': root, 'XDG_CONFIG_HOME': os.path.join(root, 'config'), 'XDG_CACHE_HOME': cache_home}
+    for _ in range(RUNS_PER_SIZE):
+        start = time.perf_counter()
+        result = subprocess.run(
+            [binary, '--config', config_path, 'no-such-action'],
+            stdout=subprocess.PIPE, stderr=subprocess.PIPE, cwd=root, env=env)
+        elapsed = time.perf_counter() - start
+        if result.returncode != 2:
+            raise RuntimeError('Unexpected exit code %d while parsing %s:\n%s' % (
+                result.returncode, config_path, result.stderr.decode('utf-8')))
+        best = elapsed if best is None else min(best, elapsed)
+        shutil.rmtree(cache_home, ignore_errors=True)
+    return best
+
+
+def main():
+    subprocess.check_call(['make'], cwd=source_root)
+    binary = os.path.join(source_root, 'bin', 'qs')
+
+    root = tempfile.mkdtemp(prefix='qs-scaling-')
+    try:
+        timings = []
+        for num_lines in LINE_COUNTS:
+            config_path = os.path.join(root, 'lines-%d.cfg' % num_lines)
+            write_config(config_path, num_lines)
+            seconds = time_parse(binary, root, config_path)
+            timings.append((num_lines, seconds))
+            print('%8d lines: %8.3f ms' % (num_lines, seconds * 1000))
+    finally:
+        shutil.rmtree(root)
+
+    failed = False
+    for (prev_lines, prev_seconds), (lines, seconds) in zip(timings, timings[1:]):
+        if prev_seconds < MIN_MEASURABLE_SECONDS:
+            continue
+        growth = seconds / prev_seconds
+        expected = MAX_GROWTH_PER_10X * (lines / prev_lines) / 10
+        if growth > expected:
+            print(f'{CRED}\u2717 Parse time grew {growth:.1f}x from {prev_lines} to {lines} lines (max {expected:.1f}x){CEND}')
+            failed = True
+
+    if failed:
+        exit(1)
+    print(f'{CGREEN}\u2713 Config parsing scales linearly{CEND}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,67 @@
+// Verifies that appending to a String is linear in the length of the result.
+//
+// Builds strings from 1 MB to 64 MB out of short appends (similar to rendering a template), and
+// prints the time per appended byte. A linear builder should take roughly the same time per byte
+// for every size. The number of times the buffer moves is also checked, since it should only grow
+// logarithmically with the size of the result.
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../string.h"
+
+#define MB (1024 * 1024)
+
+static double
+now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static u32
+build_string(u32 size, u32* num_moves)
+{
+    const char chunk[] = "echo \"some value\" ";
+    String result = string_new();
+    String previous = result;
+    *num_moves = 0;
+    while (string_len(result) < size) {
+        result = string_append(result, chunk);
+        result = string_append(result, '\n');
+        if (result != previous) {
+            (*num_moves)++;
+            previous = result;
+        }
+    }
+    u32 len = string_len(result);
+    string_free(result);
+    return len;
+}
+
+int main()
+{
+    u32 sizes[] = { 1 * MB, 4 * MB, 16 * MB, 64 * MB };
+    double ns_per_byte[4] = {};
+    for (u32 i = 0; i < 4; i++) {
+        u32 num_moves = 0;
+        double start = now_seconds();
+        u32 len = build_string(sizes[i], &num_moves);
+        double elapsed = now_seconds() - start;
+        ns_per_byte[i] = elapsed * 1e9 / len;
+        printf("%3u MB: %8.3f ms (%.3f ns/byte, %u buffer moves)\n", sizes[i] / MB, elapsed * 1000, ns_per_byte[i], num_moves);
+
+        // realloc might extend the buffer in place, so this only bounds the number of moves.
+        // Doubling from the initial buffer up to 64 MB takes about 20 steps.
+        assert(num_moves <= 32);
+    }
+
+    // Allow generous noise, but not the 64x slowdown per byte that quadratic growth would show
+    if (ns_per_byte[3] > ns_per_byte[0] * 8) {
+        printf("Appending is not linear in the length of the string\n");
+        return 1;
+    }
+    return 0;
+}
@@ -1,5 +1,11 @@
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../chars.h"
+#include "../config_lines.h"
+#include "../intern.h"
 #include "../string.h"
 
 static void test_string_eq() {
@@ -83,6 +89,345 @@ static void test_string_len() {
     }
 }
 
+static void test_arena() {
+    Arena arena = {};
+    u64* first = ARENA_ALLOC(&arena, u64, 3);
+    assert(first[0] == 0 && first[1] == 0 && first[2] == 0);
+    first[0] = 42;
+
+    // Allocations are aligned, and don't overlap
+    char* chars = ARENA_ALLOC(&arena, char, 3);
+    u64* second = ARENA_ALLOC(&arena, u64, 1);
+    assert(((u64)second & 7) == 0);
+    assert((char*)second >= chars + 3);
+
+    // Everything allocated after the mark is released (and zeroed when reused), including
+    // allocations that needed blocks of their own.
+    ArenaMark mark = arena_mark(&arena);
+    char* scratch = ARENA_ALLOC(&arena, char, 100);
+    scratch[0] = 'x';
+    char* large = ARENA_ALLOC(&arena, char, 1024 * 1024);
+    large[1024 * 1024 - 1] = 'x';
+    arena_reset(&arena, mark);
+    assert(ARENA_ALLOC(&arena, char, 100) == scratch);
+    assert(scratch[0] == 0);
+    assert(first[0] == 42);
+
+    arena_release(&arena);
+    assert(arena_mark(&arena).block == 0);
+}
+
+static void test_arena_string() {
+    Arena arena = {};
+    String str = string_new(&arena, "foobar");
+    assert(string_eq(str, "foobar"));
+    assert(string_len(str) == 6);
+
+    // Freeing an arena string is a noop
+    string_free(str);
+    assert(string_eq(str, "foobar"));
+
+    // Growing the string moves it to the heap, leaving the arena copy intact
+    String grown = string_append(str, " and then some");
+    assert(grown != str);
+    assert(string_eq(grown, "foobar and then some"));
+    assert(string_eq(str, "foobar"));
+    string_free(grown);
+
+    StringArray array = {};
+    for (u32 i = 0; i < 20; i++) {
+        string_array_push(&arena, &array, i % 2 ? "odd" : "even");
+    }
+    string_array_push(&arena, &array, "last");
+    assert(array.count == 21);
+    assert(string_eq(array.items[0], "even"));
+    assert(string_eq(array.items[19], "odd"));
+    assert(string_array_contains(&array, "last"));
+    assert(!string_array_contains(&array, "missing"));
+    string_array_reverse(&array);
+    assert(string_eq(array.items[0], "last"));
+    assert(string_eq(array.items[20], "even"));
+
+    arena_release(&arena);
+}
+
+static void test_small_string() {
+    SmallString storage;
+    String str = string_new(&storage, "foo");
+    assert(str == storage.content);
+    assert(string_eq(str, "foo"));
+    assert(string_len(str) == 3);
+
+    // Stays inline while it fits
+    str = string_append(str, "bar");
+    assert(str == storage.content);
+    assert(string_eq(str, "foobar"));
+
+    // Outgrowing the storage moves the string to the heap
+    char long_content[SMALL_STRING_CAPACITY + 2];
+    for (u32 i = 0; i < SMALL_STRING_CAPACITY + 1; i++) {
+        long_content[i] = 'x';
+    }
+    long_content[SMALL_STRING_CAPACITY + 1] = '\0';
+    str = string_copy(str, long_content);
+    assert(str != storage.content);
+    assert(string_eq(str, long_content));
+    string_free(str);
+
+    // Content that doesn't fit is put on the heap right away
+    str = string_new(&storage, long_content);
+    assert(str != storage.content);
+    assert(string_len(str) == SMALL_STRING_CAPACITY + 1);
+    string_free(str);
+
+    long_content[SMALL_STRING_CAPACITY] = '\0';
+    str = string_new(&storage, long_content);
+    assert(str == storage.content);
+    string_free(str);
+}
+
+static void test_string_view() {
+    const char line[] = "action-name = echo hello";
+    StringView name = string_view(line, 11);
+    assert(name.length == 11);
+    assert(string_view_eq(name, "action-name"));
+    assert(!string_view_eq(name, "action"));
+    assert(!string_view_eq(name, "action-name ="));
+    assert(string_view_eq(name, string_view("action-name")));
+    assert(!string_view_eq(name, string_view("action-nam")));
+    assert(string_view_eq(string_view(""), ""));
+
+    assert(string_view_starts_with(name, string_view("action")));
+    assert(!string_view_starts_with(name, string_view(line)));
+    assert(!string_view_starts_with(name, string_view("")));
+
+    assert(string_view_hash(name) == string_hash("action-name"));
+
+    Arena arena = {};
+    String copy = string_new(&arena, name);
+    assert(string_eq(copy, "action-name"));
+    assert(string_len(copy) == 11);
+    arena_release(&arena);
+}
+
+static void test_intern() {
+    assert(!intern_lookup(string_view("action")));
+
+    NameId action = intern("action");
+    NameId other = intern("other");
+    assert(action && other && action != other);
+    assert(intern_count() == 2);
+
+    // The same name always gets the same handle, no matter where it's interned from
+    const char line[] = "action = echo";
+    assert(intern(string_view(line, 6)) == action);
+    assert(intern_lookup(string_view(line, 6)) == action);
+    assert(intern_count() == 2);
+
+    assert(string_view_eq(intern_view(action), "action"));
+    assert(intern_view(action).chars[6] == '\0');
+    assert(intern_hash(action) == string_hash("action"));
+
+    // Growing the table keeps all the handles
+    char name[16];
+    for (u32 i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "name-%u", i);
+        intern(name);
+    }
+    assert(intern_lookup(string_view("action")) == action);
+    snprintf(name, sizeof(name), "name-%u", 500);
+    assert(string_view_eq(intern_view(intern_lookup(string_view(name))), name));
+
+    intern_reset();
+    assert(!intern_count());
+    assert(!intern_lookup(string_view("action")));
+}
+
+// The byte-at-a-time versions of the string primitives, to test the vectorized ones against
+static u32 reference_cstrlen(const char* cstr) {
+    u32 nul_offset = 0;
+    while (*(cstr + nul_offset++))
+        ;
+    return nul_offset - 1;
+}
+
+static bool reference_string_eq(const char* a, const char* b) {
+    while ((*a && *b) && (*a == *b)) {
+        a++;
+        b++;
+    }
+    return !(*a || *b);
+}
+
+static bool reference_string_starts_with(const char* string, const char* substring) {
+    if (!*substring) {
+        return false;
+    }
+    while (*substring && *string == *substring) {
+        string++;
+        substring++;
+    }
+    return !*substring;
+}
+
+static void check_primitives(const char* a, const char* b) {
+    assert(cstrlen(a) == reference_cstrlen(a));
+    assert(cstrlen(b) == reference_cstrlen(b));
+    assert(string_eq(a, b) == reference_string_eq(a, b));
+    assert(string_eq(b, a) == reference_string_eq(b, a));
+    assert(string_starts_with(a, b) == reference_string_starts_with(a, b));
+    assert(string_starts_with(b, a) == reference_string_starts_with(b, a));
+}
+
+static void test_string_primitives() {
+    StringSimdLevel levels[] = { StringSimdLevel_Scalar, StringSimdLevel_SSE2, StringSimdLevel_AVX2 };
+    for (u32 level = 0; level < 3; level++) {
+        string_set_simd_level(levels[level]);
+
+        assert(!string_starts_with("a", "ab"));
+        assert(!string_starts_with("", ""));
+        assert(string_starts_with("--argument", "--argument"));
+
+        // All combinations of lengths and alignments around the block sizes, with the strings
+        // differing at every position.
+        char a_buf[160];
+        char b_buf[160];
+        for (u32 len = 0; len < 70; len++) {
+            for (u32 align = 0; align < 33; align++) {
+                char* a = a_buf + align;
+                char* b = b_buf + (align * 7) % 33;
+                for (u32 i = 0; i < len; i++) {
+                    a[i] = (char)('a' + (i % 26));
+                }
+                a[len] = '\0';
+                memcpy(b, a, len + 1);
+                check_primitives(a, b);
+
+                char c[2] = { 'x', '\0' };
+                check_primitives(a, c);
+                for (u32 diff = 0; diff < len; diff++) {
+                    b[diff] = '#';
+                    check_primitives(a, b);
+                    b[diff] = '\0';
+                    check_primitives(a, b);
+                    b[diff] = a[diff];
+                }
+            }
+        }
+
+        // Strings that end right before an unmapped page must not be read past
+        u32 page_size = (u32)sysconf(_SC_PAGESIZE);
+        char* pages = (char*)mmap(0, page_size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(pages != MAP_FAILED);
+        assert(mprotect(pages + page_size, page_size, PROT_NONE) == 0);
+        char* page_end = pages + page_size;
+        for (u32 len = 0; len < 70; len++) {
+            char* a = page_end - len - 1;
+            char* b = pages + 64 + len; // aligned differently from 'a'
+            for (u32 i = 0; i < len; i++) {
+                a[i] = b[i] = (char)('a' + (i % 26));
+            }
+            a[len] = b[len] = '\0';
+            check_primitives(a, b);
+            check_primitives(b, a);
+        }
+        munmap(pages, page_size * 2);
+
+        char dest[64] = "foo";
+        cstrcat(dest, "bar");
+        assert(string_eq(dest, "foobar"));
+        cstrcpy(dest, "baz");
+        assert(string_eq(dest, "baz"));
+    }
+    string_set_simd_level(string_detect_simd_level());
+}
+
+static void test_char_classes() {
+    // Every byte value is classified the same way as by the range checks the table replaced
+    for (u32 i = 0; i < 256; i++) {
+        char c = (char)i;
+        bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        bool digit = c >= '0' && c <= '9';
+        assert(char_is(c, CharClass_Alpha) == alpha);
+        assert(char_is(c, CharClass_Digit) == digit);
+        assert(char_is(c, CharClass_Space) == (c == ' '));
+        assert(char_is(c, CharClass_Identifier) == (alpha || digit || c == '-' || c == '_'));
+    }
+
+    const char* line = "  some-name_1 := value";
+    assert(scan_while<CharClass_Space>(line, 0, 22) == 2);
+    assert(scan_while<CharClass_Identifier>(line, 2, 22) == 13);
+    assert(scan_while<CharClass_Identifier>(line, 2, 6) == 6);
+    assert(scan_while<CharClass_Identifier>(line, 0, 22) == 0);
+    assert(scan_while<CharClass_Space>(line, 22, 22) == 22);
+}
+
+static void check_config_line(const char* chars, ConfigLineKind kind, u32 name_start = 0, u32 name_end = 0, u32 value_start = 0) {
+    ConfigLineColumns columns;
+    StringView line = string_view(chars);
+    assert(classify_config_line(line, &columns) == kind);
+    if (kind == ConfigLineKind_Action || kind == ConfigLineKind_Variable) {
+        assert(columns.name_start == name_start);
+        assert(columns.name_end == name_end);
+        assert(columns.value_start == value_start);
+    }
+}
+
+static void test_config_line_classes() {
+    // The block masks agree with the class table for every byte value, at every position
+    for (u32 i = 0; i < 256; i++) {
+        char chars[CONFIG_LINE_BLOCK_SIZE];
+        memset(chars, (char)i, sizeof(chars));
+        ConfigLineBlock block;
+        config_line_block_load(&block, string_view(chars, sizeof(chars)), 0);
+        u32 all = (1u << CONFIG_LINE_BLOCK_SIZE) - 1;
+        assert(config_line_block_spaces(&block) == (char_is((char)i, CharClass_Space) ? all : 0));
+        assert(config_line_block_identifier_chars(&block) == (char_is((char)i, CharClass_Identifier) ? all : 0));
+    }
+
+    check_config_line("", ConfigLineKind_Blank);
+    check_config_line("                                   ", ConfigLineKind_Blank);
+    check_config_line("# comment = not an action", ConfigLineKind_Comment);
+    check_config_line("                    # comment", ConfigLineKind_Comment);
+    check_config_line("name = value", ConfigLineKind_Action, 0, 4, 7);
+    check_config_line("name=value", ConfigLineKind_Action, 0, 4, 5);
+    check_config_line("  name:=value", ConfigLineKind_Variable, 2, 6, 8);
+    check_config_line("name :=    ", ConfigLineKind_Variable, 0, 4, 11);
+    check_config_line("name =", ConfigLineKind_Action, 0, 4, 6);
+    check_config_line("name = # not a comment", ConfigLineKind_Action, 0, 4, 7);
+    check_config_line("                  a-very_long-identifier-0123456789 = value", ConfigLineKind_Action, 18, 51, 54);
+    check_config_line("name                                :=                  value", ConfigLineKind_Variable, 0, 4, 56);
+
+    // Anything else is left to the parser
+    check_config_line("name", ConfigLineKind_Other);
+    check_config_line("name value", ConfigLineKind_Other);
+    check_config_line("include path/to/file.cfg", ConfigLineKind_Other);
+    check_config_line("name : = value", ConfigLineKind_Other);
+    check_config_line("name:", ConfigLineKind_Other);
+    check_config_line("!name = value", ConfigLineKind_Other);
+    check_config_line("name! = value", ConfigLineKind_Other);
+    check_config_line("\tname = value", ConfigLineKind_Other);
+
+    {
+        // Lines that end right before an unmapped page must not be read past
+        u32 page_size = (u32)sysconf(_SC_PAGESIZE);
+        char* pages = (char*)mmap(0, page_size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(pages != MAP_FAILED);
+        assert(mprotect(pages + page_size, page_size, PROT_NONE) == 0);
+        char* page_end = pages + page_size;
+        for (u32 len = 1; len < 40; len++) {
+            char* chars = page_end - len;
+            memset(chars, 'a', len);
+            ConfigLineColumns columns;
+            assert(classify_config_line(string_view(chars, len), &columns) == ConfigLineKind_Other);
+            chars[len - 1] = '=';
+            assert(classify_config_line(string_view(chars, len), &columns) == (len > 1 ? ConfigLineKind_Action : ConfigLineKind_Other));
+            memset(chars, ' ', len);
+            assert(classify_config_line(string_view(chars, len), &columns) == ConfigLineKind_Blank);
+        }
+        munmap(pages, page_size * 2);
+    }
+}
 
 int main() {
     test_string_eq();
@@ -90,4 +435,12 @@ int main() {
     test_string_new();
     test_string_copy();
     test_string_len();
+    test_arena();
+    test_arena_string();
+    test_small_string();
+    test_string_view();
+    test_intern();
+    test_string_primitives();
+    test_char_classes();
+    test_config_line_classes();
 }
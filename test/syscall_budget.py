@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+#
+# Verifies the number of file system syscalls qs makes while discovering its config files.
+#
+# Runs qs under strace from directories at different depths below a source root, and counts the
+# path based syscalls (stat, access, open, readlink, ...). The first run from a directory walks up
+# to the source root, which takes a syscall per source root marker and directory level (plus one
+# to stamp the directory). The runs after it only check the stamps from the discovery cache, which
+# takes a single syscall per level. The total for a shallow directory should stay within a fixed
+# budget. Skipped if strace isn't installed.
+
+import os
+import shutil
+import subprocess
+import tempfile
+
+from test_framework import CGREEN, CRED, CYELLOW, CEND, source_root
+
+SHALLOW_DEPTH = 2
+DEEP_DEPTH = 22
+
+# Syscalls allowed for each directory level between the current directory and the source root,
+# when searching (.git, .hg and .jj) and when the search is cached
+MAX_SYSCALLS_PER_LEVEL_SEARCH = 4
+MAX_SYSCALLS_PER_LEVEL_CACHED = 1
+
+# Syscalls allowed in total for a cached run from SHALLOW_DEPTH levels below the source root. This
+# includes the loading of the binary itself (shared libraries, etc.).
+MAX_SYSCALLS_SHALLOW = 30
+
+
+def count_file_syscalls(strace, binary, cwd, env, trace_path):
+    # The action doesn't exist, so all config files are discovered and searched, but nothing is run
+    subprocess.run(
+        [strace, '-f', '-o', trace_path, '-e', 'trace=%file,getcwd', binary, 'no-such-action'],
+        stdout=subprocess.PIPE, stderr=subprocess.PIPE, cwd=cwd, env=env)
+    with open(trace_path) as f:
+        # Skip the lines about signals and exits, they aren't syscalls
+        return sum(1 for line in f if not line.lstrip('0123456789 ').startswith(('+++', '---')))
+
+
+def main():
+    strace = shutil.which('strace')
+    if not strace:
+        print(f'{CYELLOW}- Skipping the syscall budget check (strace is not installed){CEND}')
+        return
+
+    subprocess.check_call(['make'], cwd=source_root)
+    binary = os.path.join(source_root, 'bin', 'qs')
+
+    root = tempfile.mkdtemp(prefix='qs-syscalls-')
+    try:
+        env = {'HOME': root, 'XDG_CONFIG_HOME': os.path.join(root, 'config'), 'XDG_CACHE_HOME': os.path.join(root, 'cache')}
+        repo = os.path.join(root, 'repo')
+        os.makedirs(os.path.join(repo, '.git'))
+        with open(os.path.join(repo, '.qs.cfg'), 'w') as f:
+            f.write('action = echo action\n')
+
+        # Compile and cache the config first, so that the runs below only differ in the discovery
+        trace_path = os.path.join(root, 'trace')
+        count_file_syscalls(strace, binary, repo, env, trace_path)
+
+        searched = {}
+        cached = {}
+        for depth in [SHALLOW_DEPTH, DEEP_DEPTH]:
+            cwd = os.path.join(repo, *['d%d' % i for i in range(depth)])
+            os.makedirs(cwd, exist_ok=True)
+            searched[depth] = count_file_syscalls(strace, binary, cwd, env, trace_path)
+            cached[depth] = count_file_syscalls(strace, binary, cwd, env, trace_path)
+            print('%4d levels: %4d file syscalls (%d cached)' % (depth, searched[depth], cached[depth]))
+    finally:
+        shutil.rmtree(root)
+
+    failed = False
+    for name, counts, max_per_level in [('search', searched, MAX_SYSCALLS_PER_LEVEL_SEARCH), ('cached', cached, MAX_SYSCALLS_PER_LEVEL_CACHED)]:
+        per_level = (counts[DEEP_DEPTH] - counts[SHALLOW_DEPTH]) / (DEEP_DEPTH - SHALLOW_DEPTH)
+        if per_level > max_per_level:
+            print(f'{CRED}✗ Discovery ({name}) took {per_level:.1f} syscalls per directory level (max {max_per_level}){CEND}')
+            failed = True
+    if cached[SHALLOW_DEPTH] > MAX_SYSCALLS_SHALLOW:
+        print(f'{CRED}✗ A run took {cached[SHALLOW_DEPTH]} file syscalls (max {MAX_SYSCALLS_SHALLOW}){CEND}')
+        failed = True
+
+    if failed:
+        exit(1)
+    print(f'{CGREEN}✓ Config discovery is within the syscall budget{CEND}')
+
+
+if __name__ == '__main__':
+    main()
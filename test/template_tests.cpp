@@ -5,7 +5,7 @@
 #include "../string.h"
 #include "../templates.h"
 
-static void assertstr(char* actual, const char* expected)
+static void assertstr(const char* actual, const char* expected)
 {
     assert(actual);
     if (!string_eq(actual, expected)) {
@@ -14,121 +14,149 @@ static void assertstr(char* actual, const char* expected)
     }
 }
 
-static u32 varlist_size(VarList* vl)
-{
-    VarList* p = vl;
-    u32 s = 0;
-    while (p) {
-        s++;
-        p = p->next;
-    }
-    return s;
-}
-
 static void test_template_set()
 {
-    VarList* vars = template_set(0, "first", "one");
-
-    assert(vars);
-    assert(string_eq(vars->name, "first"));
-    assert(string_eq(vars->value, "one"));
-    assert(vars->next == 0);
-    assert(varlist_size(vars) == 1);
-
-    vars = template_set(vars, "second", "two");
-    assertstr(vars->name, "first");
-    assertstr(vars->next->name, "second");
-    assert(varlist_size(vars) == 2);
-
-    vars = template_set(vars, "first", "overwritten");
-    assertstr(vars->value, "overwritten");
-    assertstr(vars->next->name, "second");
-    assert(vars->next->next == 0);
-    assert(varlist_size(vars) == 2);
-
-    template_free(vars);
+    VarMap vars = {};
+    template_set(&vars, "first", "one");
+
+    assert(vars.count == 1);
+    assertstr(intern_view(vars.entries[0].name).chars, "first");
+    assertstr(inline_string_chars(&vars.entries[0].value), "one");
+
+    template_set(&vars, "second", "two");
+    assertstr(intern_view(vars.entries[0].name).chars, "first");
+    assertstr(intern_view(vars.entries[1].name).chars, "second");
+    assert(vars.count == 2);
+
+    template_set(&vars, "first", "overwritten");
+    assertstr(inline_string_chars(&vars.entries[0].value), "overwritten");
+    assertstr(intern_view(vars.entries[1].name).chars, "second");
+    assert(vars.count == 2);
+
+    // Values too long to be stored inline
+    const char* long_value = "a value that is far too long to fit in the inline storage";
+    template_set(&vars, "second", long_value);
+    assertstr(template_get(&vars, "second"), long_value);
+    template_set(&vars, "second", "short again");
+    assertstr(template_get(&vars, "second"), "short again");
+
+    template_free(&vars);
+    assert(vars.count == 0);
 }
 
 static void test_template_get()
 {
-    // VarList * vars = template_set(0, "name", "Christoffer");
-    // vars = template_set(vars, "empty", "");
-    VarList* vars = template_set(0, "empty", "");
-
-    // assertstr(template_get(vars, "name"), "Christoffer");
-    assertstr(template_get(vars, "empty"), "");
-    assert(!template_get(vars, "missing"));
+    VarMap vars = {};
+    assert(!template_get(&vars, "missing"));
+
+    template_set(&vars, "empty", "");
+    assertstr(template_get(&vars, "empty"), "");
+    assert(!template_get(&vars, "missing"));
+
+    // Enough variables to force the table to grow a couple of times
+    char name[16];
+    for (u32 i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "var%u", i);
+        template_set(&vars, name, name);
+    }
+    assert(vars.count == 1001);
+    for (u32 i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "var%u", i);
+        assertstr(template_get(&vars, name), name);
+    }
+    assertstr(template_get(&vars, string_view("var12345", 5)), "var12");
 
-    template_free(vars);
+    template_free(&vars);
 }
 
 static void test_basic_render()
 {
     String action_template = string_new("hello ${name} ${   lastname    }!");
 
-    VarList* vars = 0;
-    vars = template_set(vars, "name", "Christoffer");
-    vars = template_set(vars, "lastname", "Klang");
+    VarMap vars = {};
+    template_set(&vars, "name", "Christoffer");
+    template_set(&vars, "lastname", "Klang");
 
-    String result = template_render(action_template, vars);
+    String result = template_render(action_template, &vars);
     assertstr(result, "hello Christoffer Klang!");
     string_free(action_template);
-    template_free(vars);
+    template_free(&vars);
     string_free(result);
 }
 
+static void test_literal_escapes()
+{
+    const char* cases[][2] = {
+        { "$$", "$" },
+        { "a$$b$$", "a$b$" },
+        { "$$$$${0}$$", "$$zero$" },
+        { "{}${0}{", "{}zero{" },
+        { "trailing $", "trailing " },
+    };
+    VarMap vars = {};
+    template_set(&vars, "0", "zero");
+    for (u32 i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        String action_template = string_new(cases[i][0]);
+        String result = template_render(action_template, &vars);
+        assertstr(result, cases[i][1]);
+        string_free(result);
+        string_free(action_template);
+    }
+    template_free(&vars);
+}
+
 static void test_conditionals_basic()
 {
     String action_template = string_new("${name?}Hello ${name}${else}Hi!${end}");
-    VarList* vars = 0;
+    VarMap vars = {};
 
     String result;
 
-    result = template_render(action_template, vars);
+    result = template_render(action_template, &vars);
     assertstr(result, "Hi!");
     string_free(result);
 
-    vars = template_set(vars, "name", "Christoffer");
-    result = template_render(action_template, vars);
+    template_set(&vars, "name", "Christoffer");
+    result = template_render(action_template, &vars);
     assertstr(result, "Hello Christoffer");
     string_free(result);
 
-    vars = template_set(vars, "name", "");
-    result = template_render(action_template, vars);
+    template_set(&vars, "name", "");
+    result = template_render(action_template, &vars);
     assertstr(result, "Hi!");
     string_free(result);
 
-    template_free(vars);
+    template_free(&vars);
     string_free(action_template);
 }
 
 static void test_conditionals_nested()
 {
     String action_template = string_new("${a?}${b?}a&b${else}a&!b${end}${else}${b?}!a&b${else}!a&!b${end}${end}");
-    VarList* vars = 0;
+    VarMap vars = {};
 
     String result;
 
-    result = template_render(action_template, vars);
+    result = template_render(action_template, &vars);
     assertstr(result, "!a&!b");
     string_free(result);
 
-    vars = template_set(vars, "a", "a");
-    result = template_render(action_template, vars);
+    template_set(&vars, "a", "a");
+    result = template_render(action_template, &vars);
     assertstr(result, "a&!b");
     string_free(result);
 
-    vars = template_set(vars, "b", "b");
-    result = template_render(action_template, vars);
+    template_set(&vars, "b", "b");
+    result = template_render(action_template, &vars);
     assertstr(result, "a&b");
     string_free(result);
 
-    vars = template_set(vars, "a", "");
-    result = template_render(action_template, vars);
+    template_set(&vars, "a", "");
+    result = template_render(action_template, &vars);
     assertstr(result, "!a&b");
     string_free(result);
 
-    template_free(vars);
+    template_free(&vars);
     string_free(action_template);
 }
 
@@ -142,39 +170,124 @@ static void test_template_generate_usage()
     string_free(action_template);
 }
 
-static void test_template_merge()
+static void test_compiled_template()
 {
-    {
-        VarList* a = 0;
-        a = template_set(a, "foo", "a");
-        a = template_set(a, "bar", "a");
-        VarList* b = 0;
-        a = template_set(a, "qux", "b");
-        a = template_set(a, "bar", "b");
-
-        VarList* result = template_merge(a, b);
-        assertstr(template_get(result, "foo"), "a");
-        assertstr(template_get(result, "bar"), "b");
-        assertstr(template_get(result, "qux"), "b");
-
-        template_free(a);
-        template_free(b);
-        template_free(result);
-    }
+    String action_template = string_new("${a?}${b?}a&b${else}a&!b${end}${else}!a${end} ${0}");
+    CompiledTemplate compiled = {};
+    assert(template_compile(action_template, &compiled));
+
+    // The false branch of ${a?} is skipped by a single jump to the matching ${else}
+    assert(compiled.instructions[0].op == TemplateOp_JumpIfFalsy);
+    assert(compiled.instructions[compiled.instructions[0].target - 1].op == TemplateOp_Jump);
+
+    // The same compiled template can be rendered any number of times
+    VarMap vars = {};
+    template_set(&vars, "0", "zero");
+    String result = template_render(&compiled, &vars);
+    assertstr(result, "!a zero");
+    string_free(result);
 
-    {
-        VarList* a = template_set(0, "key", "value");
+    template_set(&vars, "a", "a");
+    result = template_render(&compiled, &vars);
+    assertstr(result, "a&!b zero");
+    string_free(result);
 
-        VarList* result = template_merge(a, 0);
-        assertstr(template_get(a, "key"), "value");
-        template_free(result);
+    template_set(&vars, "b", "b");
+    result = template_render(&compiled, &vars);
+    assertstr(result, "a&b zero");
+    string_free(result);
 
-        result = template_merge(0, a);
-        assertstr(template_get(a, "key"), "value");
+    result = template_generate_usage(&compiled, "foo");
+    assertstr(result, "Usage: foo $0 [--a <value>] [--b <value>]\n");
+    string_free(result);
 
-        template_free(result);
-        template_free(a);
-    }
+    template_free(&vars);
+    template_compiled_free(&compiled);
+    string_free(action_template);
+}
+
+static void test_template_slots()
+{
+    String action_template = string_new("${b} ${0} ${a?}${b}${end} ${3}");
+    CompiledTemplate compiled = {};
+    assert(template_compile(action_template, &compiled));
+
+    // Positional variables use their own slots, named ones follow in order of first reference
+    assert(compiled.num_slots == TEMPLATE_POSITIONAL_SLOTS + 2);
+    assert(compiled.slots[0].length == 1);
+    assert(compiled.slots[1].length == 0);
+    assert(compiled.slots[3].length == 1);
+    assert(compiled.instructions[0].slot == TEMPLATE_POSITIONAL_SLOTS);
+    assert(compiled.instructions[2].slot == 0);
+    assert(compiled.instructions[4].slot == TEMPLATE_POSITIONAL_SLOTS + 1);
+    assert(compiled.instructions[5].slot == TEMPLATE_POSITIONAL_SLOTS);
+
+    char* slot_values[TEMPLATE_POSITIONAL_SLOTS + 2] = { 0 };
+    slot_values[0] = (char*)"zero";
+    slot_values[3] = (char*)"three";
+    slot_values[TEMPLATE_POSITIONAL_SLOTS] = (char*)"b";
+    String result = template_render(&compiled, slot_values);
+    assertstr(result, "b zero  three");
+    string_free(result);
+
+    slot_values[TEMPLATE_POSITIONAL_SLOTS + 1] = (char*)"a";
+    result = template_render(&compiled, slot_values);
+    assertstr(result, "b zero b three");
+    string_free(result);
+
+    template_compiled_free(&compiled);
+    string_free(action_template);
+}
+
+static char*
+lookup_fallback(const void* source, NameId name)
+{
+    return name == intern("fallback") ? (char*)source : 0;
+}
+
+static void test_template_scopes()
+{
+    VarMap config = {};
+    template_set(&config, "foo", "config");
+    template_set(&config, "bar", "config");
+    VarMap cli = {};
+    template_set(&cli, "bar", "cli");
+    template_set(&cli, "qux", "cli");
+
+    VarScope base = {};
+    base.lookup = lookup_fallback;
+    base.source = "base";
+    VarScope config_scope = {};
+    config_scope.vars = &config;
+    config_scope.parent = &base;
+    VarScope cli_scope = {};
+    cli_scope.vars = &cli;
+    cli_scope.parent = &config_scope;
+
+    // The innermost scope that has the variable wins, and nothing is copied between the layers
+    assertstr(template_get(&cli_scope, intern("foo")), "config");
+    assertstr(template_get(&cli_scope, intern("bar")), "cli");
+    assertstr(template_get(&cli_scope, intern("qux")), "cli");
+    assertstr(template_get(&cli_scope, intern("fallback")), "base");
+    assert(!template_get(&cli_scope, intern("missing")));
+    assert(!template_get(&config_scope, intern("qux")));
+    assert(config.count == 2 && cli.count == 2);
+
+    String action_template = string_new("${foo} ${bar} ${qux} ${fallback}");
+    String result = template_render(action_template, &cli);
+    assertstr(result, " cli cli ");
+    string_free(result);
+
+    CompiledTemplate compiled = {};
+    assert(template_compile(action_template, &compiled));
+    result = template_render(&compiled, &cli_scope);
+    assertstr(result, "config cli cli base");
+    string_free(result);
+
+    template_compiled_free(&compiled);
+    string_free(action_template);
+    template_free(&config);
+    template_free(&cli);
 }
 
 int main()
@@ -182,8 +295,11 @@ int main()
     test_template_set();
     test_template_get();
     test_basic_render();
+    test_literal_escapes();
     test_conditionals_basic();
     test_conditionals_nested();
     test_template_generate_usage();
-    test_template_merge();
+    test_compiled_template();
+    test_template_slots();
+    test_template_scopes();
 }
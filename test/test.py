@@ -1,5 +1,8 @@
 #!/usr/bin/env python3
 
+import threading
+import time
+
 from test_framework import *
 
 @test
@@ -150,6 +153,29 @@ def show_available_commands(root):
         ).format(root)
     )
 
+@test({
+    'high.cfg': 'first=echo "first high"\nsecond=echo "second high"',
+    'low.cfg': 'second=echo "second low"\nthird=echo "third low"',
+    'broken.cfg': 'broken',
+})
+def action_index_shadowing(root):
+    env = {'HOME': root}
+    run('--actions', '--config', 'low.cfg', '--config', 'high.cfg', env=env).and_expect(
+        stdout = (
+            'Available actions:\n'
+            ' - first                               ({0}/high.cfg)\n'
+            ' - second                              ({0}/high.cfg)\n'
+            ' - third                               ({0}/low.cfg)'
+        ).format(root)
+    )
+    run('second', '--config', 'low.cfg', '--config', 'high.cfg', env=env).and_expect(stdout='second high')
+    run('third', '--config', 'low.cfg', '--config', 'high.cfg', env=env).and_expect(stdout='third low')
+
+    # Config files with lower priority are only loaded when needed
+    run('first', '--config', 'broken.cfg', '--config', 'high.cfg', env=env).and_expect(stdout='first high')
+    run('third', '--config', 'low.cfg', '--config', 'broken.cfg', '--config', 'high.cfg', env=env).and_expect(
+        exit_code=1, stderr_regex=r"Error in .*/broken.cfg: Expected '=' or ':='")
+
 @test({"custom.cfg": 'predefined=echo "Predefined in custom cfg works!"'})
 def resolve_action_in_custom_config():
     run('predefined', '--config', 'custom.cfg').and_expect(stdout='Predefined in custom cfg works!')
@@ -259,4 +285,317 @@ def action_cwd(root):
 def set_qs_run_dir(env):
     run('cmd', run_from_dir='workdir').and_expect(stdout='$QS_RUN_DIR=%s/workdir' % env)
 
+@test({'.qs.cfg': 'cmd=echo "first"\nflags := --foo'})
+def compiled_config_cache(root):
+    cache_home = os.path.join(root, 'cache')
+    env = {'XDG_CACHE_HOME': cache_home, 'HOME': root}
+
+    # The first run compiles the config and writes it to the cache
+    run('cmd', env=env).and_expect(stdout='first')
+    cache_files = [f for f in os.listdir(os.path.join(cache_home, 'qs')) if f.endswith('.cfgc')]
+    assert len(cache_files) == 1, cache_files
+
+    # Subsequent runs are served from the cache
+    run('cmd', env=env).and_expect(stdout='first')
+    run('--actions', env=env).and_expect(stdout='Available actions:\n - cmd                                 (%s/.qs.cfg)' % root)
+
+    # Changing the config invalidates the cached version
+    with open(os.path.join(root, '.qs.cfg'), 'w') as f:
+        f.write('cmd=echo "second ${flags}"\nflags := --bar')
+    run('cmd', env=env).and_expect(stdout='second --bar')
+    assert len([f for f in os.listdir(os.path.join(cache_home, 'qs')) if f.endswith('.cfgc')]) == 1
+
+    # Writing to the cache removes the cache files that haven't been written for a long time (at
+    # most once a day, the earlier runs have pruned the cache already)
+    os.remove(os.path.join(cache_home, 'qs', 'pruned.stamp'))
+    stale_path = os.path.join(cache_home, 'qs', '0-0.cfgc')
+    with open(stale_path, 'w') as f:
+        f.write('stale')
+    stale_time = time.time() - 60 * 24 * 60 * 60
+    os.utime(stale_path, (stale_time, stale_time))
+    with open(os.path.join(root, '.qs.cfg'), 'w') as f:
+        f.write('cmd=echo "third"')
+    run('cmd', env=env).and_expect(stdout='third')
+    assert not os.path.exists(stale_path)
+
+    # A corrupted cache file is a cache miss, and is replaced by the config compiled again
+    cache_path = os.path.join(cache_home, 'qs', cache_files[0])
+    with open(cache_path, 'rb') as f:
+        compiled = f.read()
+    with open(cache_path, 'wb') as f:
+        f.write(compiled[:-16] + b'\xff' * 16)
+    run('cmd', env=env).and_expect(stdout='third')
+    with open(cache_path, 'rb') as f:
+        assert f.read() == compiled
+
+@test({
+    'hg/.hg/store': '',
+    'hg/.qs.cfg': 'root=echo hg',
+    'jj/.jj/repo': '',
+    'jj/.qs.cfg': 'root=echo jj',
+    'worktree/.git': 'gitdir: /somewhere/else',
+    'worktree/.qs.cfg': 'root=echo worktree',
+    'hg/a/b/file': '',
+    'jj/a/file': '',
+    'worktree/a/file': '',
+})
+def source_root_markers(root):
+    run('root', run_from_dir='hg/a/b').and_expect(stdout='hg')
+    run('root', run_from_dir='jj/a').and_expect(stdout='jj')
+    run('root', run_from_dir='worktree/a').and_expect(stdout='worktree')
+
+@test({
+    '.git/config': '',
+    '.qs.cfg': 'cmd=echo "root"',
+    'a/b/c/file': '',
+})
+def discovery_cache(root):
+    cache_home = os.path.join(root, 'cache')
+    env = {'XDG_CACHE_HOME': cache_home, 'HOME': root}
+
+    # The first run searches the source tree and caches the result
+    run('cmd', run_from_dir='a/b/c', env=env).and_expect(stdout='root')
+    assert [f for f in os.listdir(os.path.join(cache_home, 'qs')) if f.endswith('.qsd')]
+    run('cmd', run_from_dir='a/b/c', env=env).and_expect(stdout='root')
+
+    # Adding a config file to the current directory invalidates the cached result
+    with open(os.path.join(root, 'a/b/c/.qs.cfg'), 'w') as f:
+        f.write('cmd=echo "cwd"')
+    run('cmd', run_from_dir='a/b/c', env=env).and_expect(stdout='cwd')
+    os.remove(os.path.join(root, 'a/b/c/.qs.cfg'))
+    run('cmd', run_from_dir='a/b/c', env=env).and_expect(stdout='root')
+
+    # So does a new source root between the current directory and the cached one
+    os.mkdir(os.path.join(root, 'a/.hg'))
+    with open(os.path.join(root, 'a/.qs.cfg'), 'w') as f:
+        f.write('cmd=echo "nested"')
+    run('cmd', run_from_dir='a/b/c', env=env).and_expect(stdout='nested')
+
+    # Removing the target of a symlinked config file doesn't change any of the searched
+    # directories, but the config file is still gone
+    os.remove(os.path.join(root, 'a/.qs.cfg'))
+    os.mkdir(os.path.join(root, 'elsewhere'))
+    with open(os.path.join(root, 'elsewhere/linked.cfg'), 'w') as f:
+        f.write('cmd=echo "linked"')
+    os.symlink(os.path.join(root, 'elsewhere/linked.cfg'), os.path.join(root, 'a/.qs.cfg'))
+    run('cmd', run_from_dir='a/b/c', env=env).and_expect(stdout='linked')
+    os.remove(os.path.join(root, 'elsewhere/linked.cfg'))
+    run('cmd', run_from_dir='a/b/c', env=env).and_expect(exit_code=2, stdout='Could not find action with name: cmd')
+
+@test({
+    '.git/config': '',
+    '.qs.cfg': 'cmd=echo "root"',
+    '.qs.d/10-base.cfg': 'cmd=echo "base"\nbase=echo "base only"\nshared=echo "shared base"',
+    '.qs.d/20-team.cfg': 'shared=echo "shared team"\nteam=echo "team ${flag}"\nflag := --team',
+    '.qs.d/README': 'not a config',
+    '.qs.d/.hidden.cfg': 'hidden=echo "hidden"',
+    'src/.qs.d/50-local.cfg': 'local=echo "local"\nshared=echo "shared local"',
+    'xdg/qs/default.cfg': 'user=echo "user default"',
+    'xdg/qs/conf.d/a.cfg': 'user=echo "user a"\nextra=echo "extra a"',
+    'xdg/qs/conf.d/b.cfg': 'extra=echo "extra b"',
+})
+def config_fragments(root):
+    env = {'XDG_CONFIG_HOME': os.path.join(root, 'xdg'), 'HOME': root}
+
+    # The config file next to a fragments directory takes priority over the fragments, and the
+    # fragments whose names sort last take priority over the others
+    run('cmd', env=env).and_expect(stdout='root')
+    run('shared', env=env).and_expect(stdout='shared team')
+    run('base', env=env).and_expect(stdout='base only')
+    run('team', env=env).and_expect(stdout='team --team')
+    run('hidden', env=env).and_expect(exit_code=2, stdout='Could not find action with name: hidden')
+
+    # Fragments in the current directory take priority over the ones in the source root
+    run('shared', run_from_dir='src', env=env).and_expect(stdout='shared local')
+    run('base', run_from_dir='src', env=env).and_expect(stdout='base only')
+
+    # conf.d fragments come after the default config
+    run('user', env=env).and_expect(stdout='user default')
+    run('extra', env=env).and_expect(stdout='extra b')
+
+    run('--actions', run_from_dir='src', env=env).and_expect(
+        stdout = (
+            'Available actions:\n'
+            ' - local                               ({0}/src/.qs.d/50-local.cfg)\n'
+            ' - shared                              ({0}/src/.qs.d/50-local.cfg)\n'
+            ' - cmd                                 ({0}/.qs.cfg)\n'
+            ' - team                                ({0}/.qs.d/20-team.cfg)\n'
+            ' - base                                ({0}/.qs.d/10-base.cfg)\n'
+            ' - user                                ({0}/xdg/qs/default.cfg)\n'
+            ' - extra                               ({0}/xdg/qs/conf.d/b.cfg)'
+        ).format(root)
+    )
+
+    # New fragments are picked up, even though the directories they're in are cached
+    with open(os.path.join(root, '.qs.d/30-new.cfg'), 'w') as f:
+        f.write('shared=echo "shared new"')
+    run('shared', env=env).and_expect(stdout='shared new')
+
+@test({
+    'shared/lib.cfg': 'include common.cfg\nbuild=echo "build ${target}"\nlib=pwd\ntarget := lib',
+    'shared/common.cfg': 'common=echo "common"\nbuild=echo "common build"',
+    'repo/.qs.cfg': 'include ../shared/lib.cfg\ninclude   ../shared/common.cfg  \nbuild=echo "repo build"\ntarget := repo',
+    'repo/other.cfg': 'include ../shared/lib.cfg\nother=echo "other ${target}"',
+    'repo/include.cfg': 'include = echo "include action"\ninclude := var',
+    'repo/verbose.cfg': 'include ../shared/lib.cfg\nmode := fast\ntarget := verbose',
+})
+def config_includes(root):
+    env = {'HOME': root}
+
+    # The including config file shadows the included actions, and its variables take precedence
+    run('build', run_from_dir='repo', env=env).and_expect(stdout='repo build')
+    run('build', '--config', 'other.cfg', run_from_dir='repo', env=env).and_expect(stdout='build lib')
+    run('lib', run_from_dir='repo', env=env).and_expect(stdout=os.path.join(root, 'repo'))
+    run('common', run_from_dir='repo', env=env).and_expect(stdout='common')
+
+    # The verbose output lists the variables of the whole include chain, with the includer's values
+    run('--verbose', '--dry-run', 'build', '--config', 'verbose.cfg', run_from_dir='repo', env=env).and_expect(
+        stdout_regex=(
+            r'.*From: {0}/shared/lib.cfg\n'
+            r'with predefined variable values:\n'
+            r' - \$\{{mode\}} => fast\n'
+            r' - \$\{{target\}} => verbose\n'
+            r'Would run: .*echo "build verbose"$'
+        ).format(re.escape(root))
+    )
+
+    # Files included by several config files are only listed (and loaded) once
+    run('--actions', '--config', 'other.cfg', run_from_dir='repo', env=env).and_expect(
+        stdout = (
+            'Available actions:\n'
+            ' - other                               ({0}/repo/other.cfg)\n'
+            ' - build                               ({0}/shared/lib.cfg)\n'
+            ' - lib                                 ({0}/shared/lib.cfg)\n'
+            ' - common                              ({0}/shared/common.cfg)'
+        ).format(root)
+    )
+
+    # 'include' is still a valid action and variable name
+    run('include', '--config', 'include.cfg', run_from_dir='repo', env=env).and_expect(stdout='include action')
+
+@test({
+    'a.cfg': 'include b.cfg\na=echo "a"',
+    'b.cfg': 'include a.cfg\nb=echo "b"',
+    'missing.cfg': 'include nowhere.cfg\nmissing=echo "missing"',
+})
+def config_include_errors(root):
+    env = {'HOME': root}
+    run('b', '--config', 'a.cfg', env=env).and_expect(
+        exit_code=1, stderr='Error in %s/b.cfg: Include cycle through %s/a.cfg' % (root, root))
+    run('a', '--config', 'a.cfg', env=env).and_expect(stdout='a')
+    run('other', '--config', 'missing.cfg', env=env).and_expect(
+        exit_code=1, stderr_regex=r'.*Error in %s/nowhere.cfg: Failed to read config file' % root)
+
+@test({
+    'a/a.cfg': 'include inc.cfg\na=echo "a"',
+    'a/inc.cfg': 'inc=echo "inc"',
+    'b/b.cfg': 'include ../shared.cfg\nb=echo "b" $$PWD',
+    'shared.cfg': 'shared=echo "shared"\nshared=echo "duplicate"',
+    'x/a.cfg': 'include shared.cfg\na=echo "a"',
+    'x/b.cfg': 'x=echo "from-b"',
+    'x/shared.cfg': 'x=echo "from-shared"',
+})
+def config_include_in_search_list(root):
+    env = {'HOME': root}
+
+    # The include of a config file that is also searched later is only loaded once, with the
+    # priority of the including config file
+    configs = ['--config', 'shared.cfg', '--config', 'a/a.cfg', '--config', 'b/b.cfg']
+    run('--check', *configs, env=env).and_expect(
+        stdout=(
+            'Warning: duplicate action name: shared (in {0}/shared.cfg)\n'
+            'Checked config files: 4'
+        ).format(root))
+    run('--actions', *configs, env=env).and_expect(
+        stdout=(
+            'Available actions:\n'
+            ' - b                                   ({0}/b/b.cfg)\n'
+            'Warning: duplicate action name: shared (in {0}/shared.cfg)\n'
+            ' - shared                              ({0}/shared.cfg)\n'
+            ' - a                                   ({0}/a/a.cfg)\n'
+            ' - inc                                 ({0}/a/inc.cfg)'
+        ).format(root))
+
+    # Searching the included config file too doesn't change which action wins
+    run('x', '--config', 'x/b.cfg', '--config', 'x/a.cfg', env=env).and_expect(stdout='from-shared')
+    run('x', '--config', 'x/shared.cfg', '--config', 'x/b.cfg', '--config', 'x/a.cfg', env=env).and_expect(
+        stdout='from-shared')
+
+    # The run directory of a searched config file follows it when includes are inserted before it
+    run('b', '--config', 'b/b.cfg', '--config', 'a/a.cfg', env=env).and_expect(
+        stdout='b %s/b' % root)
+
+@test({
+    'first.cfg': 'first=echo "first"\nfirst=echo "duplicate"',
+    'second.cfg': '!broken\nsecond=echo "second"',
+    'third.cfg': 'third=echo "third"\nthird=echo "duplicate"',
+})
+def parallel_config_loading(root):
+    env = {'HOME': root}
+    configs = ['--config', 'third.cfg', '--config', 'second.cfg', '--config', 'first.cfg']
+
+    # The config files are parsed in parallel, but the messages are only printed for the config
+    # files that the lookup gets to, in priority order
+    run('--dry-run', 'first', *configs, env=env).and_expect(
+        stdout=(
+            'Warning: duplicate action name: first (in {0}/first.cfg)\n'
+            'Would run: cd {0}; QS_RUN_DIR={0}; echo "first"'
+        ).format(root),
+        stderr='',
+    )
+    run('third', *configs, env=env).and_expect(
+        exit_code=1,
+        stdout='Warning: duplicate action name: first (in {0}/first.cfg)'.format(root),
+        stderr="Error in {0}/second.cfg: Unexpected character '!' (33)".format(root),
+    )
+
+def feed_fifo(path, content):
+    """Creates a named pipe at the path, and writes the content to it once it's opened for reading."""
+    if not os.path.exists(path):
+        os.mkfifo(path)
+    def write():
+        with open(path, 'w') as f:
+            f.write(content)
+    threading.Thread(target=write, daemon=True).start()
+
+@test({
+    'included.cfg': 'other=echo "included ${flag}"',
+    'valid.cfg': 'valid=echo "valid"',
+})
+def scanned_config_lookup(root):
+    env = {'HOME': root}
+    pipe = os.path.join(root, 'pipe.cfg')
+    content = (
+        '!invalid line\n'
+        '  lookup  =  echo "first ${flag}"\n'
+        'echo lookup = not-a-declaration\n'
+        'lookup = echo "duplicate"\n'
+        'flag := --on\n'
+        'include included.cfg\n'
+    )
+
+    # Pipes can't be cached, so they're only scanned for the action, and the other lines of the
+    # config aren't validated. Duplicates of the action are still warned about.
+    feed_fifo(pipe, content)
+    run('--dry-run', 'lookup', '--config', 'pipe.cfg', env=env).and_expect(
+        stdout=(
+            'Warning: duplicate action name: lookup (in {0}/pipe.cfg)\n'
+            'Would run: cd {0}; QS_RUN_DIR={0}; echo "first --on"'
+        ).format(root))
+    feed_fifo(pipe, content)
+    run('other', '--config', 'pipe.cfg', env=env).and_expect(stdout='included --on')
+
+    # The lines that are needed are still validated
+    feed_fifo(pipe, 'lookup = # comment\n')
+    run('lookup', '--config', 'pipe.cfg', env=env).and_expect(
+        exit_code=1, stderr="Error in %s: Action template cannot start with '#'" % pipe)
+
+    # --check parses every config file in full
+    feed_fifo(pipe, content)
+    run('--check', '--config', 'pipe.cfg', env=env).and_expect(
+        exit_code=1,
+        stderr="Error in {0}: Unexpected character '!' (33)\nError in {0}: Expected '=' or ':='".format(pipe),
+    )
+    run('--check', '--config', 'valid.cfg', env=env).and_expect(stdout='Checked config files: 1')
+
 run_tests_and_report()
@@ -26,6 +26,7 @@ _test_name = None # Name of the test that's currently running
 _test_env_root = None # the root directory where the test will run
 
 _binary_path = None # The path to the tested qs binary
+_cache_home = None # The cache directory of the qs runs that don't set their own
 _registered_tests = [] # All registered tests to run
 _verifiers = []        # List of verifiers created for each run
 _error_reports = []    # Reports of all errors
@@ -108,7 +109,7 @@ def _register_test(test_fn, test_fs=None):
     _registered_tests.append(run_test)
 
 def run(*qs_args, run_from_dir=None, env=None):
-    global _test_name, _verifiers, _test_env_root, _binary_path
+    global _test_name, _verifiers, _test_env_root, _binary_path, _cache_home
     if _test_env_root is not None:
         shutil.copy(_binary_path, os.path.join(_test_env_root))
         cwd = os.path.join(_test_env_root, run_from_dir) if run_from_dir else _test_env_root
@@ -116,6 +117,10 @@ def run(*qs_args, run_from_dir=None, env=None):
     else:
         cwd = source_root
         binary = _binary_path
+    # Keep the compiled configs out of the real cache directory, unless the test sets its own
+    env = dict(os.environ) if env is None else env
+    if 'XDG_CACHE_HOME' not in env:
+        env = {**env, 'XDG_CACHE_HOME': _cache_home}
     run_result = subprocess.run([binary, *qs_args], stdout=subprocess.PIPE, stderr=subprocess.PIPE, cwd=cwd, env=env)
     [actual_exit, actual_stdout, actual_stderr] = (run_result.returncode, run_result.stdout.decode('utf-8'), run_result.stderr.decode('utf-8'))
     actual_stdout = actual_stdout.rstrip()
@@ -132,11 +137,15 @@ def test(arg):
         return lambda test_fn: _register_test(test_fn, test_fs=arg)
 
 def run_tests_and_report():
-    global _registered_tests, _error_reports, _binary_path, _verifiers
+    global _registered_tests, _error_reports, _binary_path, _verifiers, _cache_home
     build()
 
-    for test_fn in _registered_tests:
-        test_fn()
+    _cache_home = tempfile.mkdtemp(prefix='qs-test-cache-')
+    try:
+        for test_fn in _registered_tests:
+            test_fn()
+    finally:
+        shutil.rmtree(_cache_home)
 
     num_runs = len(_verifiers)
     num_passed = 0
@@ -0,0 +1,54 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include "workers.h"
+
+struct WorkerPool {
+    u32 num_tasks;
+    WorkerTask task;
+    void* context;
+    // The index of the next task to pick, shared by all threads
+    u32 next_task;
+};
+
+static void*
+run_worker(void* pool_ptr)
+{
+    WorkerPool* pool = (WorkerPool*)pool_ptr;
+    while (true) {
+        u32 task_index = __atomic_fetch_add(&pool->next_task, 1, __ATOMIC_RELAXED);
+        if (task_index >= pool->num_tasks) {
+            break;
+        }
+        pool->task(pool->context, task_index);
+    }
+    return 0;
+}
+
+void workers_run(u32 num_tasks, WorkerTask task, void* context)
+{
+    WorkerPool pool = {};
+    pool.num_tasks = num_tasks;
+    pool.task = task;
+    pool.context = context;
+
+    // The calling thread is one of the workers, so start one thread less than there are workers
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 num_workers = num_cpus > 0 ? (u32)num_cpus : 1;
+    num_workers = num_workers < num_tasks ? num_workers : num_tasks;
+    num_workers = num_workers < WORKERS_MAX_THREADS ? num_workers : WORKERS_MAX_THREADS;
+
+    pthread_t threads[WORKERS_MAX_THREADS];
+    u32 num_threads = 0;
+    while (num_threads + 1 < num_workers) {
+        if (pthread_create(threads + num_threads, 0, run_worker, &pool) != 0) {
+            break;
+        }
+        num_threads++;
+    }
+
+    run_worker(&pool);
+    for (u32 i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], 0);
+    }
+}
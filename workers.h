@@ -0,0 +1,19 @@
+#pragma once
+
+#include "base.h"
+
+// The most threads that are started for a single run of tasks
+#define WORKERS_MAX_THREADS 8
+
+/** A task run by workers_run(). Called once for each task index, possibly from different threads. */
+typedef void (*WorkerTask)(void* context, u32 task_index);
+
+/**
+ * Runs 'task' for every task index in [0, num_tasks) on a pool of worker threads, and returns once
+ * all of them have finished. The tasks are picked in order, but can finish in any order.
+ *
+ * The calling thread works on the tasks too, so they're all run (one after another) even if no
+ * threads could be started. At most one thread per online CPU is used, and never more than
+ * WORKERS_MAX_THREADS.
+ */
+void workers_run(u32 num_tasks, WorkerTask task, void* context);